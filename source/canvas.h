@@ -0,0 +1,137 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <vector>
+#include <algorithm>
+
+#include <SFML/Graphics.hpp>
+
+/*
+*   Canvas class
+*   Stores the drawing grid, renders it with a single vertex array
+*   and keeps the 28x28 MNIST down sample up to date on every cell change.
+*   Every grid cell belongs to exactly one MNIST block, the block sums are updated
+*   incrementally, so a stroke only touches the block it falls into.
+*/
+class Canvas {
+    public:
+        static constexpr int MNIST_SIZE = 28;
+
+        Canvas(const int gridWidth, const int gridHeight, const int cellSize);
+        ~Canvas();
+
+        void setCell(const int x, const int y, const bool black);
+        void clear();
+        void draw(sf::RenderTarget &target) const { target.draw(m_vertices); }
+
+        /* dirty is set by every cell change and reset with markClean, after the grid was queried */
+        bool isDirty() const { return m_dirty; }
+        void markClean() { m_dirty = false; }
+
+        const std::vector<float> &getMNIST() const { return m_mnist; }
+
+    private:
+        void setCellColor(const int x, const int y, const sf::Color color);
+
+        int m_gridWidth;
+        std::vector<int> m_grid;
+
+        /* 6 vertices (two triangles) per grid cell */
+        sf::VertexArray m_vertices;
+
+        /* maps a grid column/row to its MNIST block */
+        std::vector<int> m_blockOfColumn;
+        std::vector<int> m_blockOfRow;
+        std::vector<int> m_blockSums;
+        std::vector<int> m_blockCounts;
+        std::vector<float> m_mnist;
+
+        bool m_dirty = false;
+};
+
+inline Canvas::Canvas(const int gridWidth, const int gridHeight, const int cellSize):
+    m_gridWidth(gridWidth),
+    m_grid(gridWidth * gridHeight, 0),
+    m_vertices(sf::PrimitiveType::Triangles, gridWidth * gridHeight * 6),
+    m_blockOfColumn(gridWidth), m_blockOfRow(gridHeight),
+    m_blockSums(MNIST_SIZE * MNIST_SIZE, 0), m_blockCounts(MNIST_SIZE * MNIST_SIZE, 0),
+    m_mnist(MNIST_SIZE * MNIST_SIZE, 0.0)
+{
+    /* same block boundaries as the full down sample: block x covers [x * w / 28, (x + 1) * w / 28) */
+    for (int x = 0; x < MNIST_SIZE; x++) {
+        for (int gx = x * gridWidth / MNIST_SIZE; gx < (x + 1) * gridWidth / MNIST_SIZE; gx++) {
+            m_blockOfColumn[gx] = x;
+        }
+    }
+    for (int y = 0; y < MNIST_SIZE; y++) {
+        for (int gy = y * gridHeight / MNIST_SIZE; gy < (y + 1) * gridHeight / MNIST_SIZE; gy++) {
+            m_blockOfRow[gy] = y;
+        }
+    }
+
+    for (int gy = 0; gy < gridHeight; gy++) {
+        for (int gx = 0; gx < gridWidth; gx++) {
+            m_blockCounts[m_blockOfRow[gy] * MNIST_SIZE + m_blockOfColumn[gx]]++;
+        }
+    }
+
+    /* the geometry never changes, only the colors do */
+    for (int gy = 0; gy < gridHeight; gy++) {
+        for (int gx = 0; gx < gridWidth; gx++) {
+            sf::Vertex *quad = &m_vertices[(gy * gridWidth + gx) * 6];
+            float left = gx * cellSize;
+            float top = gy * cellSize;
+            float right = left + cellSize;
+            float bottom = top + cellSize;
+
+            quad[0].position = sf::Vector2f(left, top);
+            quad[1].position = sf::Vector2f(right, top);
+            quad[2].position = sf::Vector2f(left, bottom);
+            quad[3].position = sf::Vector2f(left, bottom);
+            quad[4].position = sf::Vector2f(right, top);
+            quad[5].position = sf::Vector2f(right, bottom);
+
+            for (int i = 0; i < 6; i++) {
+                quad[i].color = sf::Color::White;
+            }
+        }
+    }
+}
+
+inline Canvas::~Canvas() {}
+
+inline void Canvas::setCell(const int x, const int y, const bool black) {
+    int value = black ? 1 : 0;
+    int &cell = m_grid[y * m_gridWidth + x];
+    if (cell == value) {
+        return;
+    }
+    cell = value;
+    setCellColor(x, y, black ? sf::Color::Black : sf::Color::White);
+
+    /* update the running sum of the block, the average is scaled to 0 - 255 */
+    int block = m_blockOfRow[y] * MNIST_SIZE + m_blockOfColumn[x];
+    m_blockSums[block] += black ? 1 : -1;
+    m_mnist[block] = static_cast<float>(m_blockSums[block]) / m_blockCounts[block] * 255;
+
+    m_dirty = true;
+}
+
+inline void Canvas::clear() {
+    std::fill(m_grid.begin(), m_grid.end(), 0);
+    std::fill(m_blockSums.begin(), m_blockSums.end(), 0);
+    std::fill(m_mnist.begin(), m_mnist.end(), 0.0);
+    for (size_t i = 0; i < m_vertices.getVertexCount(); i++) {
+        m_vertices[i].color = sf::Color::White;
+    }
+    m_dirty = true;
+}
+
+inline void Canvas::setCellColor(const int x, const int y, const sf::Color color) {
+    sf::Vertex *quad = &m_vertices[(y * m_gridWidth + x) * 6];
+    for (int i = 0; i < 6; i++) {
+        quad[i].color = color;
+    }
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+
+/* POSIX file io, needed for fsync */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "neuralnetwork.h"
+#include "layer.h"
+#include "snapshotworker.h"
+
+/*
+*   AsyncCheckpointer class
+*   Takes a snapshot of the network weights on the calling thread and
+*   serializes/writes it on a background thread, so training only stalls for the copy.
+*   Checkpoints are written to <directory>/checkpoint_<step>.txt via a temp file,
+*   fsync and atomic rename, only the last keepLast checkpoints are kept.
+*   Checkpoints already in the directory (e.g. from a previous run) count as the oldest ones,
+*   a checkpoint reusing a step number replaces the older file and becomes the newest.
+*/
+template <typename T>
+class AsyncCheckpointer {
+    public:
+        AsyncCheckpointer(const std::string &directory, const size_t keepLast);
+
+        void checkpoint(const NeuralNetwork<T> &nn, const size_t step);
+        void wait();
+
+        size_t getWritten() const;
+        size_t getDropped() const;
+        size_t getFailed() const;
+        std::chrono::nanoseconds getLastStall() const { return m_lastStall; }
+        std::chrono::nanoseconds getTotalStall() const { return m_totalStall; }
+        std::vector<std::filesystem::path> getCheckpoints() const;
+
+    private:
+        struct Snapshot {
+            ModelSnapshot<T> model;
+            size_t step;
+        };
+
+        void findExisting();
+        void write(const Snapshot &snapshot);
+        void prune();
+
+        std::filesystem::path m_directory;
+        size_t m_keepLast;
+
+        /* written checkpoints, oldest first, shared between the worker and getCheckpoints */
+        size_t m_written = 0;
+        std::vector<std::filesystem::path> m_checkpoints;
+        mutable std::mutex m_mutex;
+
+        std::chrono::nanoseconds m_lastStall{0};
+        std::chrono::nanoseconds m_totalStall{0};
+
+        /* last member, joined before the state write uses is destroyed */
+        SnapshotWorker<Snapshot> m_worker;
+};
+
+template <typename T>
+AsyncCheckpointer<T>::AsyncCheckpointer(const std::string &directory, const size_t keepLast):
+    m_directory(directory), m_keepLast(keepLast),
+    m_worker("writing checkpoint", [this](Snapshot &snapshot) { write(snapshot); })
+{
+    if (keepLast == 0) {
+        std::cerr << "Atleast one checkpoint must be kept" << std::endl;
+        throw std::invalid_argument("Atleast one checkpoint must be kept");
+    }
+
+    std::filesystem::create_directories(m_directory);
+    findExisting();
+}
+
+/*
+*   Only the weight copy happens on the calling thread.
+*   If the worker has not picked up the previous snapshot yet, it is replaced by the newer one
+*/
+template <typename T>
+void AsyncCheckpointer<T>::checkpoint(const NeuralNetwork<T> &nn, const size_t step) {
+    auto start = std::chrono::steady_clock::now();
+
+    m_worker.submit(Snapshot{nn.snapshotWeights(), step});
+
+    m_lastStall = std::chrono::steady_clock::now() - start;
+    m_totalStall += m_lastStall;
+}
+
+/* blocks until every requested checkpoint is on disk */
+template <typename T>
+void AsyncCheckpointer<T>::wait() {
+    m_worker.wait();
+}
+
+template <typename T>
+size_t AsyncCheckpointer<T>::getWritten() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_written;
+}
+
+template <typename T>
+size_t AsyncCheckpointer<T>::getDropped() const {
+    return m_worker.getDropped();
+}
+
+template <typename T>
+size_t AsyncCheckpointer<T>::getFailed() const {
+    return m_worker.getFailed();
+}
+
+template <typename T>
+std::vector<std::filesystem::path> AsyncCheckpointer<T>::getCheckpoints() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_checkpoints;
+}
+
+/*
+*   picks up the checkpoints of earlier runs, oldest first, so they are pruned like our own
+*   only checkpoint_<step>.txt is adopted, other files in the directory are never touched
+*/
+template <typename T>
+void AsyncCheckpointer<T>::findExisting() {
+    const std::string prefix = "checkpoint_";
+    const std::string suffix = ".txt";
+
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> existing;
+    for (auto &entry : std::filesystem::directory_iterator(m_directory)) {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_regular_file() || name.size() <= prefix.size() + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+
+        std::string step = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (std::all_of(step.begin(), step.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            existing.push_back({entry.last_write_time(), entry.path()});
+        }
+    }
+
+    std::sort(existing.begin(), existing.end());
+    for (auto &file : existing) {
+        m_checkpoints.push_back(file.second);
+    }
+}
+
+template <typename T>
+void AsyncCheckpointer<T>::write(const Snapshot &snapshot) {
+    std::ostringstream buffer;
+    NeuralNetwork<T>::writeModel(buffer, snapshot.model);
+    const std::string data = buffer.str();
+
+    std::filesystem::path path = m_directory / ("checkpoint_" + std::to_string(snapshot.step) + ".txt");
+    std::filesystem::path tmpPath = path;
+    tmpPath += ".tmp";
+
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file: " + tmpPath.string() + ": " + std::strerror(errno));
+    }
+
+    /* a failed write must not leave the temp file behind */
+    auto fail = [&](const std::string &what, int err) {
+        ::close(fd);
+        std::error_code ec;
+        std::filesystem::remove(tmpPath, ec);
+        throw std::runtime_error(what + ": " + tmpPath.string() + ": " + std::strerror(err));
+    };
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Could not write file", errno);
+        }
+        offset += n;
+    }
+
+    /* data has to be on disk before the rename makes it visible */
+    if (::fsync(fd) != 0) {
+        fail("Could not sync file", errno);
+    }
+    if (::close(fd) != 0) {
+        int err = errno;
+        std::error_code ec;
+        std::filesystem::remove(tmpPath, ec);
+        throw std::runtime_error("Could not close file: " + tmpPath.string() + ": " + std::strerror(err));
+    }
+
+    std::error_code renameError;
+    std::filesystem::rename(tmpPath, path, renameError);
+    if (renameError) {
+        std::error_code ec;
+        std::filesystem::remove(tmpPath, ec);
+        throw std::runtime_error("Could not rename file: " + tmpPath.string() + ": " + renameError.message());
+    }
+
+    /* sync the directory, so the rename itself is durable */
+    int dirFd = ::open(m_directory.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        /* the file was replaced, it must not be pruned as an old checkpoint */
+        m_checkpoints.erase(std::remove(m_checkpoints.begin(), m_checkpoints.end(), path), m_checkpoints.end());
+        m_checkpoints.push_back(path);
+        m_written++;
+    }
+    prune();
+}
+
+/* remove everything but the newest keepLast checkpoints */
+template <typename T>
+void AsyncCheckpointer<T>::prune() {
+    std::vector<std::filesystem::path> expired;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_checkpoints.size() > m_keepLast) {
+            expired.push_back(m_checkpoints.front());
+            m_checkpoints.erase(m_checkpoints.begin());
+        }
+    }
+
+    for (auto &path : expired) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        if (ec) {
+            std::cerr << "Could not remove checkpoint: " << path << ": " << ec.message() << std::endl;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef EXPRESSIONS_H
+#define EXPRESSIONS_H
+
+/*
+*   Expression templates for std::vector<T> and std::vector<std::vector<T>>
+*   Operators only build a lightweight expression tree, nothing is computed until the
+*   expression is assigned, then every element of the destination is evaluated in one fused loop.
+*
+*   auto update = learningRate * outer(view(e) * view(o) * (T(1) - view(o)), view(p));
+*   assign(W, view(W) + update);
+*
+*   * between two expressions is the elementwise (hadamard) product.
+*   Leaves reference the wrapped vectors, so they have to outlive the expression.
+*   Reading the destination inside the expression is fine as long as only the element that is written
+*   is read (W = W + ...), but not for transpose or outer products of the destination itself.
+*/
+
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <cstddef>
+
+namespace expressions {
+    template <typename E>
+    class VectorExpression {
+        public:
+            const E &self() const { return static_cast<const E &>(*this); }
+            size_t size() const { return self().size(); }
+            auto operator[](const size_t i) const { return self()[i]; }
+    };
+
+    template <typename E>
+    class MatrixExpression {
+        public:
+            const E &self() const { return static_cast<const E &>(*this); }
+            size_t rows() const { return self().rows(); }
+            size_t cols() const { return self().cols(); }
+            auto operator()(const size_t i, const size_t j) const { return self()(i, j); }
+    };
+
+    template <typename E>
+    constexpr bool is_vector_expression = std::is_base_of_v<VectorExpression<E>, E>;
+
+    template <typename E>
+    constexpr bool is_matrix_expression = std::is_base_of_v<MatrixExpression<E>, E>;
+
+    /* leaves */
+
+    template <typename T>
+    class VectorView : public VectorExpression<VectorView<T>> {
+        public:
+            explicit VectorView(const std::vector<T> &v): m_v(v) {}
+            size_t size() const { return m_v.size(); }
+            T operator[](const size_t i) const { return m_v[i]; }
+
+        private:
+            const std::vector<T> &m_v;
+    };
+
+    template <typename T>
+    class MatrixView : public MatrixExpression<MatrixView<T>> {
+        public:
+            explicit MatrixView(const std::vector<std::vector<T>> &m): m_m(m) {}
+            size_t rows() const { return m_m.size(); }
+            size_t cols() const { return m_m.empty() ? 0 : m_m[0].size(); }
+            T operator()(const size_t i, const size_t j) const { return m_m[i][j]; }
+
+        private:
+            const std::vector<std::vector<T>> &m_m;
+    };
+
+    template <typename T>
+    VectorView<T> view(const std::vector<T> &v) { return VectorView<T>(v); }
+
+    template <typename T>
+    MatrixView<T> view(const std::vector<std::vector<T>> &m) { return MatrixView<T>(m); }
+
+    /* vector nodes */
+
+    template <typename Op, typename L, typename R>
+    class VectorBinary : public VectorExpression<VectorBinary<Op, L, R>> {
+        public:
+            VectorBinary(const L &l, const R &r): m_l(l), m_r(r) {}
+            size_t size() const { return m_l.size(); }
+            auto operator[](const size_t i) const { return Op()(m_l[i], m_r[i]); }
+
+        private:
+            L m_l;
+            R m_r;
+    };
+
+    /* scalar op vector or vector op scalar, the scalar side is selected by ScalarLeft */
+    template <typename Op, typename S, typename E, bool ScalarLeft>
+    class VectorScalar : public VectorExpression<VectorScalar<Op, S, E, ScalarLeft>> {
+        public:
+            VectorScalar(const S &s, const E &e): m_s(s), m_e(e) {}
+            size_t size() const { return m_e.size(); }
+            auto operator[](const size_t i) const {
+                if constexpr (ScalarLeft) {
+                    return Op()(m_s, m_e[i]);
+                } else {
+                    return Op()(m_e[i], m_s);
+                }
+            }
+
+        private:
+            S m_s;
+            E m_e;
+    };
+
+    /* matrix nodes */
+
+    template <typename Op, typename L, typename R>
+    class MatrixBinary : public MatrixExpression<MatrixBinary<Op, L, R>> {
+        public:
+            MatrixBinary(const L &l, const R &r): m_l(l), m_r(r) {}
+            size_t rows() const { return m_l.rows(); }
+            size_t cols() const { return m_l.cols(); }
+            auto operator()(const size_t i, const size_t j) const { return Op()(m_l(i, j), m_r(i, j)); }
+
+        private:
+            L m_l;
+            R m_r;
+    };
+
+    template <typename Op, typename S, typename E, bool ScalarLeft>
+    class MatrixScalar : public MatrixExpression<MatrixScalar<Op, S, E, ScalarLeft>> {
+        public:
+            MatrixScalar(const S &s, const E &e): m_s(s), m_e(e) {}
+            size_t rows() const { return m_e.rows(); }
+            size_t cols() const { return m_e.cols(); }
+            auto operator()(const size_t i, const size_t j) const {
+                if constexpr (ScalarLeft) {
+                    return Op()(m_s, m_e(i, j));
+                } else {
+                    return Op()(m_e(i, j), m_s);
+                }
+            }
+
+        private:
+            S m_s;
+            E m_e;
+    };
+
+    template <typename E>
+    class Transpose : public MatrixExpression<Transpose<E>> {
+        public:
+            explicit Transpose(const E &e): m_e(e) {}
+            size_t rows() const { return m_e.cols(); }
+            size_t cols() const { return m_e.rows(); }
+            auto operator()(const size_t i, const size_t j) const { return m_e(j, i); }
+
+        private:
+            E m_e;
+    };
+
+    /* u * v^T */
+    template <typename U, typename V>
+    class Outer : public MatrixExpression<Outer<U, V>> {
+        public:
+            Outer(const U &u, const V &v): m_u(u), m_v(v) {}
+            size_t rows() const { return m_u.size(); }
+            size_t cols() const { return m_v.size(); }
+            auto operator()(const size_t i, const size_t j) const { return m_u[i] * m_v[j]; }
+
+        private:
+            U m_u;
+            V m_v;
+    };
+
+    template <typename E>
+    Transpose<E> transpose(const MatrixExpression<E> &e) { return Transpose<E>(e.self()); }
+
+    template <typename U, typename V>
+    Outer<U, V> outer(const VectorExpression<U> &u, const VectorExpression<V> &v) { return Outer<U, V>(u.self(), v.self()); }
+
+    /*
+    *   operators, one set for expression op expression, scalar op expression and expression op scalar
+    */
+
+    template <typename Op, typename L, typename R>
+    auto make_expression(const L &l, const R &r) {
+        if constexpr (is_vector_expression<L> && is_vector_expression<R>) {
+            return VectorBinary<Op, L, R>(l, r);
+        } else if constexpr (is_matrix_expression<L> && is_matrix_expression<R>) {
+            return MatrixBinary<Op, L, R>(l, r);
+        } else if constexpr (std::is_arithmetic_v<L> && is_vector_expression<R>) {
+            return VectorScalar<Op, L, R, true>(l, r);
+        } else if constexpr (std::is_arithmetic_v<L> && is_matrix_expression<R>) {
+            return MatrixScalar<Op, L, R, true>(l, r);
+        } else if constexpr (is_vector_expression<L> && std::is_arithmetic_v<R>) {
+            return VectorScalar<Op, R, L, false>(r, l);
+        } else {
+            return MatrixScalar<Op, R, L, false>(r, l);
+        }
+    }
+
+    template <typename L, typename R>
+    constexpr bool is_operand_pair =
+        (is_vector_expression<L> && (is_vector_expression<R> || std::is_arithmetic_v<R>)) ||
+        (is_matrix_expression<L> && (is_matrix_expression<R> || std::is_arithmetic_v<R>)) ||
+        (std::is_arithmetic_v<L> && (is_vector_expression<R> || is_matrix_expression<R>));
+
+    template <typename L, typename R, typename = std::enable_if_t<is_operand_pair<L, R>>>
+    auto operator+(const L &l, const R &r) { return make_expression<std::plus<>>(l, r); }
+
+    template <typename L, typename R, typename = std::enable_if_t<is_operand_pair<L, R>>>
+    auto operator-(const L &l, const R &r) { return make_expression<std::minus<>>(l, r); }
+
+    template <typename L, typename R, typename = std::enable_if_t<is_operand_pair<L, R>>>
+    auto operator*(const L &l, const R &r) { return make_expression<std::multiplies<>>(l, r); }
+
+    /*
+    *   evaluation
+    */
+
+    template <typename T, typename E>
+    void assign(std::vector<T> &dest, const VectorExpression<E> &e) {
+        const E &expression = e.self();
+        dest.resize(expression.size());
+        for (size_t i = 0; i < dest.size(); i++) {
+            dest[i] = static_cast<T>(expression[i]);
+        }
+    }
+
+    /* evaluates only the rows [begin, end), dest has to have the shape of the expression already */
+    template <typename T, typename E>
+    void assign_rows(std::vector<std::vector<T>> &dest, const MatrixExpression<E> &e, const size_t begin, const size_t end) {
+        const E &expression = e.self();
+        size_t cols = expression.cols();
+        for (size_t i = begin; i < end; i++) {
+            T *row = dest[i].data();
+            for (size_t j = 0; j < cols; j++) {
+                row[j] = static_cast<T>(expression(i, j));
+            }
+        }
+    }
+
+    template <typename T, typename E>
+    void assign(std::vector<std::vector<T>> &dest, const MatrixExpression<E> &e) {
+        const E &expression = e.self();
+        dest.resize(expression.rows());
+        for (auto &row : dest) {
+            row.resize(expression.cols());
+        }
+        assign_rows(dest, e, 0, dest.size());
+    }
+}
+
+#endif
@@ -4,90 +4,587 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <cstdint>
+#include <algorithm>
 
 #include "vectorops.h"
 #include "activations.h"
+#include "threadpool.h"
+
+/* geometry of a layer output, dense layers are (neurons, 1, 1) */
+struct Dims {
+    int channels;
+    int height;
+    int width;
+
+    int size() const { return channels * height * width; }
+};
+
+enum class LayerType { Dense, Conv2D, MaxPool };
+
+/*
+*   Scratch buffers of the convolution kernels, allocated once by Layer::makeWorkspace
+*   cols: im2col of the input, products: one row per filter (outputs or deltas),
+*   errorCols: W^T * error before col2im, changes: weight changes, empty for all other layer types
+*/
+template <typename T>
+struct Workspace {
+    std::vector<std::vector<T>> cols;
+    std::vector<std::vector<T>> products;
+    std::vector<std::vector<T>> errorCols;
+    std::vector<std::vector<T>> changes;
+};
 
 /*
 * Layer class
 * Stores a vector of neurons aka weights
+* The descriptor selects the layer type:
+*   "sigmoid", "relu", "tanh", "none"   dense layer, units = neurons
+*                                       without randomInit, "none" is the identity input layer,
+*                                       which passes the geometry of its input on
+*   "conv<k>:<activation>"              kxk convolution (stride 1, no padding), units = filters
+*   "maxpool"                           max pooling with stride = size, units = pool size
+* Convolutions keep one row of weights per filter and are executed as im2col + matrix multiplication.
+* If sharded, the rows are split into one contiguous range per worker of the pool,
+* forward, backward and the weight update of dense layers then run on all shards in parallel
 */
 template <typename T>
 class Layer {
     public:
-        Layer(const int numNeurons, const std::string activationFunction, const std::pair<int, int> shape, const bool randomInit);
+        Layer(const int units, const std::string descriptor, const Dims inputDims, const bool randomInit, const uint64_t seed = 0, const uint32_t stream = 0);
+        /* takes the given weights without any initialization, e.g. from a snapshot, they have to fit the layer */
+        Layer(const int units, const std::string descriptor, const Dims inputDims, const std::vector<std::vector<T>> &weights);
         ~Layer();
 
+        /* copies are not sharded, the pool belongs to the network of the original */
+        Layer(const Layer &other);
+        Layer &operator=(const Layer &other);
+        Layer(Layer &&other) = default;
+        Layer &operator=(Layer &&other) = default;
+
         int getNeurons() const { return m_neurons; }
+        int getUnits() const { return m_units; }
+        LayerType getType() const { return m_type; }
+        Dims getOutputDims() const { return m_outputDims; }
+        std::string getDescriptor() const { return m_descriptor; }
         std::string getActivation() const { return m_activation; }
         std::vector<std::vector<T>> getWeights() const { return m_weights; }
+        bool hasWeights() const { return !m_weights.empty(); }
         std::function<T(T)> getActivationFunction() const { return m_activationFunction; }
-        void setWeights(const std::vector<std::vector<T>> &weights) { m_weights = weights; }
+        void setWeights(const std::vector<std::vector<T>> &weights);
         void updateWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate);
 
+        std::vector<T> forward(const std::vector<T> &input) const;
+        std::vector<T> backpropagateError(const std::vector<T> &error, const std::vector<T> &input) const;
+
+        /*
+        *   Hot path kernels without any checks, the caller guarantees the sizes
+        *   (input: inputDims, output/error: neurons, prevError: inputDims), e.g. after validate
+        *   and passes a workspace of this layer, so nothing is allocated
+        */
+        void forwardUnchecked(const std::vector<T> &input, std::vector<T> &output, Workspace<T> &workspace) const;
+        void backpropagateErrorUnchecked(const std::vector<T> &error, const std::vector<T> &input, std::vector<T> &prevError, Workspace<T> &workspace) const;
+        void updateWeightsUnchecked(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate, Workspace<T> &workspace);
+
+        Workspace<T> makeWorkspace() const;
+
+        void validate(const Dims &inputDims) const;
+        void validateWeights(const std::vector<std::vector<T>> &weights) const;
+
+        void shard(ThreadPool *pool);
+        bool isSharded() const { return m_pool != nullptr; }
+
     private:
+        std::pair<int, int> configure(const bool passthrough);
+        std::pair<size_t, size_t> shardRows(const size_t shard) const;
+
+        void forwardDense(const std::vector<T> &input, std::vector<T> &output) const;
+        void forwardConv(const std::vector<T> &input, std::vector<T> &output, Workspace<T> &workspace) const;
+        void forwardPool(const std::vector<T> &input, std::vector<T> &output) const;
+        void backpropagateDense(const std::vector<T> &error, std::vector<T> &prevError) const;
+        void backpropagateConv(const std::vector<T> &error, std::vector<T> &prevError, Workspace<T> &workspace) const;
+        void backpropagatePool(const std::vector<T> &error, const std::vector<T> &input, std::vector<T> &prevError) const;
+        void updateDenseWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate);
+        void updateConvWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate, Workspace<T> &workspace);
+
+        LayerType m_type;
+        int m_units;
         int m_neurons;
+        int m_kernel = 0;
+        Dims m_inputDims;
+        Dims m_outputDims;
+        std::string m_descriptor;
         std::string m_activation;
         std::vector<std::vector<T>> m_weights;
         std::function<T(T)> m_activationFunction;
+
+        /* not owned, the network keeps the pool alive */
+        ThreadPool *m_pool = nullptr;
+        /* per shard partial sums of the backpropagated error */
+        mutable std::vector<std::vector<T>> m_partialErrors;
 };
 
 template <typename T>
-Layer<T>::Layer(const int numNeurons, const std::string activationFunction, const std::pair<int, int> shape, const bool randomInit):
-    m_neurons(numNeurons),  m_activation(activationFunction)
+Layer<T>::Layer(const int units, const std::string descriptor, const Dims inputDims, const bool randomInit, const uint64_t seed, const uint32_t stream):
+    m_type(LayerType::Dense), m_units(units), m_neurons(units), m_inputDims(inputDims), m_outputDims{units, 1, 1},
+    m_descriptor(descriptor), m_activation(descriptor)
 {
-    /* init weights */
-    if (randomInit) {
-        /* 
-        *   If the low and high bound is to high, the sigmoid function will always return 1
-        *   This is because the sigmoid function is limited to 0 and 1, thus the network will not learn
-        *   0.5 seems to be a good starting bound
-        */
-        uniform_random_initialization<T>(m_weights, shape, -0.5, 0.5);
-    } else {
+    std::pair<int, int> shape = configure(!randomInit);
+
+    /* 
+    *   init weights, the same seed and stream always yield the same weights
+    *   If the bounds are to high, the sigmoid function will always return 1 and the network will not learn,
+    *   so the bounds are scaled with the fan in/out of the layer, depending on the activation
+    *   pooling layers have no weights
+    */
+    if (m_type == LayerType::MaxPool) {
+        m_weights.clear();
+    } else if (!randomInit) {
         unit_matrix_initialization<T>(m_weights, shape);
+    } else if (m_activation == "relu") {
+        he_uniform_initialization<T>(m_weights, shape, seed, stream);
+    } else if (m_type == LayerType::Conv2D) {
+        /* every output position sees k * k inputs per channel and feeds k * k positions per filter */
+        xavier_uniform_initialization<T>(m_weights, shape, shape.second, units * m_kernel * m_kernel, seed, stream);
+    } else {
+        xavier_uniform_initialization<T>(m_weights, shape, seed, stream);
+    }
+}
+
+template <typename T>
+Layer<T>::Layer(const int units, const std::string descriptor, const Dims inputDims, const std::vector<std::vector<T>> &weights):
+    m_type(LayerType::Dense), m_units(units), m_neurons(units), m_inputDims(inputDims), m_outputDims{units, 1, 1},
+    m_descriptor(descriptor), m_activation(descriptor)
+{
+    configure(false);
+    validateWeights(weights);
+    m_weights = weights;
+}
+
+/*
+*   Parses the descriptor into type, geometry and activation, returns the shape of the weight matrix
+*   passthrough: the layer is the identity input layer and keeps the geometry of its input
+*/
+template <typename T>
+std::pair<int, int> Layer<T>::configure(const bool passthrough) {
+    const std::string &descriptor = m_descriptor;
+    const Dims &inputDims = m_inputDims;
+    const int units = m_units;
+    std::pair<int, int> shape = {units, inputDims.size()};
+
+    if (descriptor.rfind("conv", 0) == 0) {
+        size_t colon = descriptor.find(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid convolution descriptor: " << descriptor << std::endl;
+            throw std::invalid_argument("Invalid convolution descriptor");
+        }
+        m_type = LayerType::Conv2D;
+        m_kernel = std::stoi(descriptor.substr(4, colon - 4));
+        m_activation = descriptor.substr(colon + 1);
+
+        if (m_kernel < 1 || m_kernel > inputDims.height || m_kernel > inputDims.width) {
+            std::cerr << "Convolution kernel does not fit the input: " << descriptor << std::endl;
+            throw std::invalid_argument("Convolution kernel does not fit the input");
+        }
+        m_outputDims = {units, inputDims.height - m_kernel + 1, inputDims.width - m_kernel + 1};
+        shape = {units, inputDims.channels * m_kernel * m_kernel};
+    } else if (descriptor == "maxpool") {
+        m_type = LayerType::MaxPool;
+        m_activation = "none";
+
+        if (units < 1 || inputDims.height % units != 0 || inputDims.width % units != 0) {
+            std::cerr << "Pool size does not divide the input: " << units << std::endl;
+            throw std::invalid_argument("Pool size does not divide the input");
+        }
+        m_outputDims = {inputDims.channels, inputDims.height / units, inputDims.width / units};
+    } else if (descriptor == "none" && passthrough) {
+        /* the identity input layer passes its geometry on, dense layers with linear activation do not */
+        m_outputDims = inputDims;
     }
+    m_neurons = m_outputDims.size();
 
     /* init activation function */
-    if (activationFunction == "sigmoid") {
+    if (m_activation == "sigmoid") {
         m_activationFunction = activations::sigmoid<T>;
-    } else if (activationFunction == "relu") {
+    } else if (m_activation == "relu") {
         m_activationFunction = activations::relu<T>;
-    } else if (activationFunction == "tanh") {
+    } else if (m_activation == "tanh") {
         m_activationFunction = activations::tanh<T>;
-    } else if (activationFunction == "none") {
+    } else if (m_activation == "none") {
         m_activationFunction = [](T x) { return x; };
     } else {
         std::cerr << "Invalid activation function" << std::endl;
         throw std::invalid_argument("Invalid activation function");
     }
+
+    return shape;
 }
 
 template<typename T>
 Layer<T>::~Layer() {}
 
+template<typename T>
+Layer<T>::Layer(const Layer &other):
+    m_type(other.m_type), m_units(other.m_units), m_neurons(other.m_neurons), m_kernel(other.m_kernel),
+    m_inputDims(other.m_inputDims), m_outputDims(other.m_outputDims), m_descriptor(other.m_descriptor),
+    m_activation(other.m_activation), m_weights(other.m_weights), m_activationFunction(other.m_activationFunction)
+{}
+
+template<typename T>
+Layer<T> &Layer<T>::operator=(const Layer &other) {
+    if (this != &other) {
+        m_type = other.m_type;
+        m_units = other.m_units;
+        m_neurons = other.m_neurons;
+        m_kernel = other.m_kernel;
+        m_inputDims = other.m_inputDims;
+        m_outputDims = other.m_outputDims;
+        m_descriptor = other.m_descriptor;
+        m_activation = other.m_activation;
+        m_weights = other.m_weights;
+        m_activationFunction = other.m_activationFunction;
+        m_pool = nullptr;
+        m_partialErrors.clear();
+    }
+    return *this;
+}
+
+template<typename T>
+void Layer<T>::setWeights(const std::vector<std::vector<T>> &weights) {
+    m_weights = weights;
+
+    /* redistribute the new rows to their shards */
+    if (m_pool) {
+        shard(m_pool);
+    }
+}
+
+/*
+*   Distributes the rows to the workers of the pool, passing nullptr switches back to single threaded execution
+*   Every worker copies its rows into memory it allocates itself (first touch)
+*   Only dense layers are sharded, convolution and pooling layers stay on the calling thread
+*/
+template<typename T>
+void Layer<T>::shard(ThreadPool *pool) {
+    m_pool = m_type == LayerType::Dense ? pool : nullptr;
+    if (!m_pool) {
+        m_partialErrors.clear();
+        return;
+    }
+
+    /* read before the workers start, shard 0 swaps row 0 while the others size their partial sums */
+    const size_t cols = m_weights[0].size();
+    m_partialErrors.assign(m_pool->size(), std::vector<T>());
+    m_pool->run([this, cols](size_t s) {
+        auto [begin, end] = shardRows(s);
+        for (size_t k = begin; k < end; k++) {
+            std::vector<T> row(m_weights[k]);
+            m_weights[k].swap(row);
+        }
+        m_partialErrors[s].resize(cols);
+    });
+}
+
+template<typename T>
+std::pair<size_t, size_t> Layer<T>::shardRows(const size_t shard) const {
+    size_t numShards = m_pool ? m_pool->size() : 1;
+    size_t rowsPerShard = (m_weights.size() + numShards - 1) / numShards;
+    size_t begin = std::min(m_weights.size(), shard * rowsPerShard);
+    size_t end = std::min(m_weights.size(), begin + rowsPerShard);
+    return {begin, end};
+}
+
+/*
+*   Checked entry points, validate the sizes on every call and allocate the result
+*/
+template<typename T>
+std::vector<T> Layer<T>::forward(const std::vector<T> &input) const {
+    if (m_type != LayerType::MaxPool && (m_weights.empty() || input.size() != static_cast<size_t>(m_inputDims.size()))) {
+        throw std::invalid_argument("Matrix and vector dimensions do not match");
+    }
+    if (m_type == LayerType::MaxPool && input.size() != static_cast<size_t>(m_inputDims.size())) {
+        throw std::invalid_argument("Input size does not match pooling layer size");
+    }
+
+    std::vector<T> output(m_neurons);
+    Workspace<T> workspace = makeWorkspace();
+    forwardUnchecked(input, output, workspace);
+    return output;
+}
+
+template<typename T>
+std::vector<T> Layer<T>::backpropagateError(const std::vector<T> &error, const std::vector<T> &input) const {
+    if (error.size() != static_cast<size_t>(m_neurons)) {
+        throw std::invalid_argument("Matrix and vector dimensions do not match");
+    }
+    if (m_type == LayerType::MaxPool && input.size() != static_cast<size_t>(m_inputDims.size())) {
+        throw std::invalid_argument("Error size does not match pooling layer size");
+    }
+
+    std::vector<T> prevError(m_inputDims.size());
+    Workspace<T> workspace = makeWorkspace();
+    backpropagateErrorUnchecked(error, input, prevError, workspace);
+    return prevError;
+}
+
 template<typename T>
 void Layer<T>::updateWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate) {
     /* check dimensions */
-    if (error.size() != m_neurons || output.size() != m_neurons || prevOutput.size() != m_weights[0].size()) {
+    size_t neurons = m_neurons;
+    if (error.size() != neurons || output.size() != neurons || prevOutput.size() != static_cast<size_t>(m_inputDims.size())) {
         throw std::invalid_argument("Dimensions dont fit to update the weights");
     }
 
-    /* 
-    *   deltaW(j,k) = lr * error(k) * output(k) * (1 - output(k)) * output(j)
-    *   start at the output layer and move backwards
-    *   It contains the errors, which can be added to the weights, in order to update the weights
-    *
-    *  k= rows, j = columns 
-    */
-    for (int k = 0; k < m_neurons; ++k) {
-        for (int j = 0; j < m_weights[0].size(); ++j) {
-            /* calculate the need change in the weight */
-            T change_w = error[k] * output[k] * (1.0 - (output[k])) * prevOutput[j];
-            /* calculate the new weight */
-            m_weights[k][j] = m_weights[k][j] + (learningRate * change_w);
+    Workspace<T> workspace = makeWorkspace();
+    updateWeightsUnchecked(error, output, prevOutput, learningRate, workspace);
+}
+
+/* checks once, that the layer fits behind a layer with the given output and that the weights have the expected shape */
+template<typename T>
+void Layer<T>::validate(const Dims &inputDims) const {
+    if (inputDims.size() != m_inputDims.size()) {
+        throw std::invalid_argument("Layer input does not match the previous layer output");
+    }
+    if (!m_activationFunction) {
+        throw std::invalid_argument("Layer has no activation function");
+    }
+
+    validateWeights(m_weights);
+}
+
+/* checks that a weight matrix has the shape this layer expects, pooling layers have none */
+template<typename T>
+void Layer<T>::validateWeights(const std::vector<std::vector<T>> &weights) const {
+    size_t rows = m_type == LayerType::MaxPool ? 0 : m_units;
+    size_t cols = m_type == LayerType::Conv2D ? m_inputDims.channels * m_kernel * m_kernel : m_inputDims.size();
+    if (weights.size() != rows) {
+        throw std::invalid_argument("Weight rows do not match the layer");
+    }
+    for (const auto &row : weights) {
+        if (row.size() != cols) {
+            throw std::invalid_argument("Weight columns do not match the layer");
         }
     }
 }
 
-#endif
\ No newline at end of file
+/* dense and pooling layers work in place, only convolutions need scratch buffers */
+template<typename T>
+Workspace<T> Layer<T>::makeWorkspace() const {
+    Workspace<T> workspace;
+    if (m_type == LayerType::Conv2D) {
+        size_t patch = m_inputDims.channels * m_kernel * m_kernel;
+        size_t positions = m_outputDims.height * m_outputDims.width;
+        workspace.cols.assign(patch, std::vector<T>(positions));
+        workspace.products.assign(m_units, std::vector<T>(positions));
+        workspace.errorCols.assign(patch, std::vector<T>(positions));
+        workspace.changes.assign(m_units, std::vector<T>(patch));
+    }
+    return workspace;
+}
+
+template<typename T>
+void Layer<T>::forwardUnchecked(const std::vector<T> &input, std::vector<T> &output, Workspace<T> &workspace) const {
+    switch (m_type) {
+        case LayerType::Dense: forwardDense(input, output); break;
+        case LayerType::Conv2D: forwardConv(input, output, workspace); break;
+        case LayerType::MaxPool: forwardPool(input, output); break;
+    }
+}
+
+template<typename T>
+void Layer<T>::backpropagateErrorUnchecked(const std::vector<T> &error, const std::vector<T> &input, std::vector<T> &prevError, Workspace<T> &workspace) const {
+    switch (m_type) {
+        case LayerType::Dense: backpropagateDense(error, prevError); break;
+        case LayerType::Conv2D: backpropagateConv(error, prevError, workspace); break;
+        case LayerType::MaxPool: backpropagatePool(error, input, prevError); break;
+    }
+}
+
+template<typename T>
+void Layer<T>::updateWeightsUnchecked(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate, Workspace<T> &workspace) {
+    switch (m_type) {
+        case LayerType::Dense: updateDenseWeights(error, output, prevOutput, learningRate); break;
+        case LayerType::Conv2D: updateConvWeights(error, output, prevOutput, learningRate, workspace); break;
+        /* nothing to learn for pooling */
+        case LayerType::MaxPool: break;
+    }
+}
+
+/* output = activation(W * input) */
+template<typename T>
+void Layer<T>::forwardDense(const std::vector<T> &input, std::vector<T> &output) const {
+    auto forwardRows = [&](size_t s) {
+        auto [begin, end] = shardRows(s);
+        for (size_t k = begin; k < end; k++) {
+            const T *w = m_weights[k].data();
+            T sum = 0;
+            for (size_t j = 0; j < input.size(); j++) {
+                sum += w[j] * input[j];
+            }
+            output[k] = m_activationFunction(sum);
+        }
+    };
+
+    if (m_pool) {
+        m_pool->run(forwardRows);
+    } else {
+        forwardRows(0);
+    }
+}
+
+/*
+*   hidden errors are split by weights and recombined into the previous layer: W^T * error
+*   sharded, every shard sums up the contribution of its rows, the partial sums are then reduced by column ranges
+*/
+template<typename T>
+void Layer<T>::backpropagateDense(const std::vector<T> &error, std::vector<T> &prevError) const {
+    size_t cols = prevError.size();
+    std::fill(prevError.begin(), prevError.end(), T(0));
+
+    if (!m_pool) {
+        for (size_t k = 0; k < m_weights.size(); k++) {
+            const T *w = m_weights[k].data();
+            for (size_t j = 0; j < cols; j++) {
+                prevError[j] += w[j] * error[k];
+            }
+        }
+        return;
+    }
+
+    m_pool->run([&](size_t s) {
+        auto [begin, end] = shardRows(s);
+        std::vector<T> &partial = m_partialErrors[s];
+        std::fill(partial.begin(), partial.end(), T(0));
+        for (size_t k = begin; k < end; k++) {
+            const T *w = m_weights[k].data();
+            for (size_t j = 0; j < cols; j++) {
+                partial[j] += w[j] * error[k];
+            }
+        }
+    });
+
+    m_pool->run([&](size_t s) {
+        size_t colsPerShard = (cols + m_pool->size() - 1) / m_pool->size();
+        size_t begin = std::min(cols, s * colsPerShard);
+        size_t end = std::min(cols, begin + colsPerShard);
+        for (const auto &partial : m_partialErrors) {
+            for (size_t j = begin; j < end; j++) {
+                prevError[j] += partial[j];
+            }
+        }
+    });
+}
+
+/* 
+*   deltaW(j,k) = lr * error(k) * output(k) * (1 - output(k)) * output(j)
+*   start at the output layer and move backwards
+*   It contains the errors, which can be added to the weights, in order to update the weights
+*
+*  k= rows, j = columns 
+*/
+template<typename T>
+void Layer<T>::updateDenseWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate) {
+    using namespace expressions;
+
+    /* W = W + lr * (error * output * (1 - output)) x prevOutput, evaluated in one pass over the rows */
+    auto change = learningRate * outer(view(error) * view(output) * (T(1) - view(output)), view(prevOutput));
+    auto updateRows = [&](size_t s) {
+        auto [begin, end] = shardRows(s);
+        assign_rows(m_weights, view(m_weights) + change, begin, end);
+    };
+
+    if (m_pool) {
+        m_pool->run(updateRows);
+    } else {
+        updateRows(0);
+    }
+}
+
+/* out(f, y, x) = activation(sum over the kxk patch at (y, x) of all input channels * filter f) */
+template<typename T>
+void Layer<T>::forwardConv(const std::vector<T> &input, std::vector<T> &output, Workspace<T> &workspace) const {
+    im2col_unchecked(input, m_inputDims.channels, m_inputDims.height, m_inputDims.width, m_kernel, workspace.cols);
+    matrix_matrix_multiplication_unchecked(m_weights, workspace.cols, workspace.products);
+
+    size_t i = 0;
+    for (auto &row : workspace.products) {
+        for (auto &o : row) {
+            output[i++] = m_activationFunction(o);
+        }
+    }
+}
+
+template<typename T>
+void Layer<T>::forwardPool(const std::vector<T> &input, std::vector<T> &output) const {
+    for (int c = 0; c < m_outputDims.channels; c++) {
+        for (int y = 0; y < m_outputDims.height; y++) {
+            for (int x = 0; x < m_outputDims.width; x++) {
+                T max = input[(c * m_inputDims.height + y * m_units) * m_inputDims.width + x * m_units];
+                for (int py = 0; py < m_units; py++) {
+                    for (int px = 0; px < m_units; px++) {
+                        max = std::max(max, input[(c * m_inputDims.height + y * m_units + py) * m_inputDims.width + x * m_units + px]);
+                    }
+                }
+                output[(c * m_outputDims.height + y) * m_outputDims.width + x] = max;
+            }
+        }
+    }
+}
+
+/* same as dense layers, W^T * error, but per patch: the columns are folded back into the image */
+template<typename T>
+void Layer<T>::backpropagateConv(const std::vector<T> &error, std::vector<T> &prevError, Workspace<T> &workspace) const {
+    size_t positions = m_outputDims.height * m_outputDims.width;
+    for (int f = 0; f < m_units; f++) {
+        std::copy(error.begin() + f * positions, error.begin() + (f + 1) * positions, workspace.products[f].begin());
+    }
+
+    transposed_matrix_multiplication_unchecked(m_weights, workspace.products, workspace.errorCols);
+    col2im_unchecked(workspace.errorCols, m_inputDims.channels, m_inputDims.height, m_inputDims.width, m_kernel, prevError);
+}
+
+/* the error of a pooling window goes to the input that won the max */
+template<typename T>
+void Layer<T>::backpropagatePool(const std::vector<T> &error, const std::vector<T> &input, std::vector<T> &prevError) const {
+    std::fill(prevError.begin(), prevError.end(), T(0));
+    for (int c = 0; c < m_outputDims.channels; c++) {
+        for (int y = 0; y < m_outputDims.height; y++) {
+            for (int x = 0; x < m_outputDims.width; x++) {
+                size_t maxIndex = (c * m_inputDims.height + y * m_units) * m_inputDims.width + x * m_units;
+                for (int py = 0; py < m_units; py++) {
+                    for (int px = 0; px < m_units; px++) {
+                        size_t index = (c * m_inputDims.height + y * m_units + py) * m_inputDims.width + x * m_units + px;
+                        if (input[index] > input[maxIndex]) {
+                            maxIndex = index;
+                        }
+                    }
+                }
+                prevError[maxIndex] += error[(c * m_outputDims.height + y) * m_outputDims.width + x];
+            }
+        }
+    }
+}
+
+/*
+*   Same update rule as dense layers, the filter weights are shared by all positions,
+*   so the changes of every position are summed: deltaW = lr * (error * output * (1 - output)) * cols^T
+*/
+template<typename T>
+void Layer<T>::updateConvWeights(const std::vector<T> &error, const std::vector<T> &output, const std::vector<T> &prevOutput, const T learningRate, Workspace<T> &workspace) {
+    using namespace expressions;
+
+    size_t positions = m_outputDims.height * m_outputDims.width;
+    for (int f = 0; f < m_units; f++) {
+        T *delta = workspace.products[f].data();
+        for (size_t p = 0; p < positions; p++) {
+            T o = output[f * positions + p];
+            delta[p] = error[f * positions + p] * o * (T(1) - o);
+        }
+    }
+
+    im2col_unchecked(prevOutput, m_inputDims.channels, m_inputDims.height, m_inputDims.width, m_kernel, workspace.cols);
+    matrix_transposed_multiplication_unchecked(workspace.products, workspace.cols, workspace.changes);
+    assign_rows(m_weights, view(m_weights) + learningRate * view(workspace.changes), 0, m_weights.size());
+}
+
+#endif
@@ -5,14 +5,19 @@
 #include <sstream>
 #include <algorithm>
 #include <filesystem>
+#include <chrono>
+#include <iomanip>
 
 /* GUI Stuff */
 #include <SFML/Graphics.hpp>
+#include "canvas.h"
 
 /* NN Stuff */
 #include "neuralnetwork.h"
 #include "activations.h"
 #include "vectorops.h"
+#include "checkpoint.h"
+#include "validation.h"
 
 constexpr int CANVAS_WIDTH = 400;  // Pixels
 constexpr int CANVAS_HEIGHT = 400; // Pixels
@@ -129,8 +134,12 @@ void testModel(std::string test_csv, NeuralNetwork<T> &nn) {
     std::cout << "Accuracy: " << (scoreboard / (float)test_data.size()) * 100 << "%" << std::endl;
 }
 
+/*
+*   If a checkpointer is given, a checkpoint is taken every checkpointInterval samples,
+*   the weights are written in the background while training continues
+*/
 template <typename T>
-void trainModel(std::string training_csv, NeuralNetwork<T> &nn) {
+void trainModel(std::string training_csv, NeuralNetwork<T> &nn, AsyncCheckpointer<T> *checkpointer = nullptr, int checkpointInterval = 0) {
     /* read training csv */
     std::vector<std::vector<float>> training_data = readCSV<float>(training_csv);
     
@@ -139,7 +148,81 @@ void trainModel(std::string training_csv, NeuralNetwork<T> &nn) {
         std::vector<float> input = getInput<float>(training_data.at(i));
         std::vector<float> target = getTargets<float>(training_data.at(i), 10);
         nn.train(input, target);
+
+        if (checkpointer && checkpointInterval > 0 && (i + 1) % checkpointInterval == 0) {
+            checkpointer->checkpoint(nn, i + 1);
+        }
+    }
+
+    if (checkpointer) {
+        checkpointer->wait();
+        std::cout << "Checkpoints written: " << checkpointer->getWritten() << " ";
+        std::cout << "dropped: " << checkpointer->getDropped() << " ";
+        std::cout << "failed: " << checkpointer->getFailed() << " ";
+        std::cout << "total stall: " << std::chrono::duration<double, std::milli>(checkpointer->getTotalStall()).count() << "ms" << std::endl;
+    }
+}
+
+/*
+*   Holds back the last validationSplit of the training csv, every validationInterval samples
+*   a snapshot is validated in the background. Training stops once the validation accuracy
+*   did not improve by more than minDelta for patience validations, the best weights are restored at the end
+*/
+template <typename T>
+void trainModelEarlyStopping(std::string training_csv, NeuralNetwork<T> &nn, int epochs, float validationSplit, int validationInterval, int patience, float minDelta) {
+    /* read training csv */
+    std::vector<std::vector<float>> training_data = readCSV<float>(training_csv);
+
+    /* split off the validation data */
+    size_t validationSize = training_data.size() * validationSplit;
+    if (validationSize == 0 || validationSize >= training_data.size()) {
+        throw std::invalid_argument("Validation split leaves no training or no validation data");
+    }
+    size_t trainingSize = training_data.size() - validationSize;
+    if (validationInterval < 1) {
+        throw std::invalid_argument("Validation interval must be atleast one sample");
+    }
+
+    std::vector<std::vector<T>> validationInputs;
+    std::vector<int> validationLabels;
+    for (size_t i = trainingSize; i < training_data.size(); i++) {
+        validationInputs.push_back(getInput<float>(training_data.at(i)));
+        validationLabels.push_back(training_data.at(i).at(0));
+    }
+
+    ValidationMonitor<T> monitor(validationInputs, validationLabels, patience, minDelta);
+
+    /* train the model */
+    size_t step = 0;
+    for (int epoch = 0; epoch < epochs && !monitor.shouldStop(); epoch++) {
+        for (size_t i = 0; i < trainingSize && !monitor.shouldStop(); i++) {
+            std::vector<float> input = getInput<float>(training_data.at(i));
+            std::vector<float> target = getTargets<float>(training_data.at(i), 10);
+            nn.train(input, target);
+
+            if (++step % validationInterval == 0) {
+                monitor.submit(nn, step);
+            }
+        }
     }
+
+    /* validate the final weights too, unless the last step was just submitted */
+    if (step % validationInterval != 0) {
+        monitor.submit(nn, step);
+    }
+    monitor.wait();
+
+    std::cout << "step, seconds, validation accuracy" << std::endl;
+    for (auto &entry : monitor.getLog()) {
+        std::cout << entry.step << ", " << entry.seconds << ", " << entry.accuracy * 100 << "%" << std::endl;
+    }
+    std::cout << "dropped snapshots: " << monitor.getDropped() << std::endl;
+
+    if (monitor.shouldStop()) {
+        std::cout << "Stopped early after " << step << " samples" << std::endl;
+    }
+    monitor.restoreBest(nn);
+    std::cout << "Restored best model from step " << monitor.getBestStep() << " with " << monitor.getBestAccuracy() * 100 << "% validation accuracy" << std::endl;
 }
 
 template <typename T>
@@ -167,40 +250,12 @@ void saveToPNG(std::vector<int> mnistGrid, std::string filename) {
     }
 }
 
-/* to use the numbers drawn on the canvas, it needs to be down sampled to a 28x28 image */
-std::vector<float> downSampleMNIST(std::vector<std::vector<int>> &grid) {
-    const int blockSize = 4;
-    constexpr int MNIST_SIZE = 28;
-    std::vector<float> mnistGrid((MNIST_SIZE * MNIST_SIZE), 0.0);
-
-    for (int y = 0; y < MNIST_SIZE; y++) {
-        for (int x = 0; x < MNIST_SIZE; x++) {
-            /* define the block cells to average 4x4 */
-            int startX = x * 100 / MNIST_SIZE;
-            int endX = (x + 1) * 100 / MNIST_SIZE;
-            int startY = y * 100 / MNIST_SIZE;
-            int endY = (y + 1) * 100 / MNIST_SIZE;
-
-            int sum = 0;
-            int count = 0;
-            for (int gy = startY; gy < endY; gy++) {
-                for (int gx = startX; gx < endX; gx++) {
-                    sum += grid[gy][gx];
-                    count++;
-                }
-            }
-
-            float avg = static_cast<float>(sum) / count; // 0.0 - 1.0
-            mnistGrid[y * 28 + x] = avg * 255; 
-        }
-    }
-    return mnistGrid;
-}
-
 int main (int argc, const char *argv[]) {
     try {
         /* NN Stuff */
         NeuralNetwork nn = NeuralNetwork<float>({{784, "none"}, {100, "sigmoid"}, {10, "sigmoid"}}, 0.3);
+        /* all inputs are 784 values (csv rows and the canvas), so the shapes only need to be checked once */
+        nn.compile();
         if (std::filesystem::exists("model.txt")) {
             std::cout << "Loading model from file" << std::endl;
             nn.loadModel("model.txt");
@@ -217,7 +272,15 @@ int main (int argc, const char *argv[]) {
         /* GUI Stuff */
         sf::RenderWindow window(sf::VideoMode({CANVAS_WIDTH, CANVAS_HEIGHT}), "Neuralnet");
 
-        std::vector<std::vector<int>> grid(GRID_HEIGHT, std::vector<int>(GRID_WIDTH, 0));
+        Canvas canvas(GRID_WIDTH, GRID_HEIGHT, CELL_SIZE);
+
+        /* in live mode every stroke update is sent to the NN, frame time and latency are shown in the title */
+        bool liveMode = false;
+        int prediction = -1;
+        double frameMs = 0.0;
+        double inferenceMs = 0.0;
+        auto lastFrame = std::chrono::steady_clock::now();
+        auto lastTitleUpdate = lastFrame;
 
         while (window.isOpen()) {
             while (const std::optional event = window.pollEvent()) {
@@ -231,15 +294,19 @@ int main (int argc, const char *argv[]) {
                     }
                     /* clear canvas if q is pressed */
                     if (keyPressed->scancode == sf::Keyboard::Scancode::Q) {
-                        for (auto &row: grid) {
-                            std::fill(row.begin(), row.end(), 0);
-                        }
+                        canvas.clear();
                     }
                     /* if S is pressed, send grid to NN */
                     if (keyPressed->scancode == sf::Keyboard::Scancode::S) {
                         std::cout << "QUERY" << std::endl;
-                        std::vector<float> input = downSampleMNIST(grid);
-                        queryModel(nn, input);
+                        queryModel(nn, canvas.getMNIST());
+                    }
+                    /* toggle live prediction if L is pressed */
+                    if (keyPressed->scancode == sf::Keyboard::Scancode::L) {
+                        liveMode = !liveMode;
+                        if (!liveMode) {
+                            window.setTitle("Neuralnet");
+                        }
                     }
                 }
             }
@@ -252,29 +319,40 @@ int main (int argc, const char *argv[]) {
             if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left) && inBounds) {
                 int gridX = mousePos.x / CELL_SIZE;
                 int gridY = mousePos.y / CELL_SIZE;
-                grid[gridY][gridX] = 1; // Paint black
+                canvas.setCell(gridX, gridY, true); // Paint black
             }
 
             if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Right) && inBounds) {
                 int gridX = mousePos.x / CELL_SIZE;
                 int gridY = mousePos.y / CELL_SIZE;
-                grid[gridY][gridX] = 0; // Erase to white
+                canvas.setCell(gridX, gridY, false); // Erase to white
             }
 
-            window.clear(sf::Color::White);
-
-            for (int x = 0; x < GRID_WIDTH; x++) {
-                for (int y = 0; y < GRID_HEIGHT; y++) {
-                    if (grid[y][x] == 1) { // Only draw black cells
-                        sf::RectangleShape cell(sf::Vector2f(CELL_SIZE, CELL_SIZE));
-                        cell.setPosition(sf::Vector2f(x * CELL_SIZE, y * CELL_SIZE));
-                        cell.setFillColor(sf::Color::Black);
-                        window.draw(cell);
-                    }
-                }
+            /* the down sample is kept up to date by the canvas, so only the query is left */
+            if (liveMode && canvas.isDirty()) {
+                auto start = std::chrono::steady_clock::now();
+                prediction = getIndexOfTarget<float>(nn.query(canvas.getMNIST()));
+                inferenceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                canvas.markClean();
             }
 
+            window.clear(sf::Color::White);
+            canvas.draw(window);
             window.display();
+
+            auto now = std::chrono::steady_clock::now();
+            frameMs = std::chrono::duration<double, std::milli>(now - lastFrame).count();
+            lastFrame = now;
+
+            /* updating the title is not free on every platform, refresh it a few times per second */
+            if (liveMode && now - lastTitleUpdate > std::chrono::milliseconds(250)) {
+                std::ostringstream title;
+                title << std::fixed << std::setprecision(2);
+                title << "Neuralnet - Prediction: " << prediction;
+                title << " | frame " << frameMs << "ms | inference " << inferenceMs << "ms";
+                window.setTitle(title.str());
+                lastTitleUpdate = now;
+            }
         }
 
     } catch (const std::exception &e) {
@@ -3,29 +3,91 @@
 
 #include <vector>
 #include <string>
+#include <ostream>
+#include <random>
+#include <cstdint>
+#include <memory>
+#include <cmath>
+#include <optional>
 
 #include "layer.h"
 #include "vectorops.h"
+#include "threadpool.h"
+
+/*
+*   Trainable state of a network: learning rate, shape entries (units, descriptor) of all layers
+*   and the weights of layers 1..n, weights[i] belongs to layer i + 1 and is empty for pooling layers.
+*   The identity weights of the input layer are not part of it, they are never stored.
+*/
+template <typename T>
+struct ModelSnapshot {
+    float learningRate;
+    std::vector<std::pair<int, std::string>> shape;
+    std::vector<std::vector<std::vector<T>>> weights;
+};
 
 template <typename T>
 class NeuralNetwork {
     public:
-        NeuralNetwork(const std::vector<std::pair<int, std::string>> &shape, float learningRate);
+        NeuralNetwork(const std::vector<std::pair<int, std::string>> &shape, float learningRate, const uint64_t seed = std::random_device{}());
+        explicit NeuralNetwork(const ModelSnapshot<T> &model);
         ~NeuralNetwork();
 
-        void train(std::vector<T> input, std::vector<T> target);
-        std::vector<T> query(std::vector<T> input);
+        /* like layers, copies run single threaded */
+        NeuralNetwork(const NeuralNetwork &other);
+        NeuralNetwork &operator=(const NeuralNetwork &other);
+        NeuralNetwork(NeuralNetwork &&other) = default;
+        NeuralNetwork &operator=(NeuralNetwork &&other) = default;
+
+        void train(const std::vector<T> &input, const std::vector<T> &target);
+        std::vector<T> query(const std::vector<T> &input);
         void saveModel(const std::string &path);
         void loadModel(const std::string &path);
         void printweights(); 
 
+        void enableRowSharding(const size_t numThreads);
+        void disableRowSharding();
+
+        void compile(const bool debug = false);
+        bool isCompiled() const { return m_plan.has_value(); }
+
+        float getLearningRate() const { return m_learningRate; }
+
+        ModelSnapshot<T> snapshotWeights() const;
+        void restoreWeights(const ModelSnapshot<T> &model);
+        static void writeModel(std::ostream &out, const ModelSnapshot<T> &model);
+
     private:
+        /*
+        *   Execution plan, created by compile once all shapes are validated
+        *   outputs[i] and errors[i] are the preallocated output and error of layer i,
+        *   layer 1 does not propagate its error back, so errors[0] stays empty,
+        *   workspaces[i] the scratch buffers of its kernels,
+        *   the identity input layer is not part of the plan
+        */
+        struct ExecutionPlan {
+            bool debug;
+            std::vector<std::vector<T>> outputs;
+            std::vector<std::vector<T>> errors;
+            std::vector<Workspace<T>> workspaces;
+        };
+
+        static Dims inputDims(const int neurons);
+        void recompile();
+        std::vector<T> queryCompiled(const std::vector<T> &input);
+        void trainCompiled(const std::vector<T> &input, const std::vector<T> &target);
+
         std::vector<Layer<T>> m_layers;
         float m_learningRate;
+
+        /* workers for row sharded execution, nullptr if every layer runs on the calling thread */
+        std::shared_ptr<ThreadPool> m_pool;
+
+        std::optional<ExecutionPlan> m_plan;
 };
 
 template <typename T>
-NeuralNetwork<T>::NeuralNetwork(const std::vector<std::pair<int, std::string>> &shape, float learningRate):
+NeuralNetwork<T>::NeuralNetwork(const std::vector<std::pair<int, std::string>> &shape, float learningRate, const uint64_t seed):
     m_learningRate(learningRate)
 {
     /* first layer has no activation */
@@ -44,21 +106,68 @@ NeuralNetwork<T>::NeuralNetwork(const std::vector<std::pair<int, std::string>> &
     m_layers.push_back(Layer<T>(
         shape[0].first,
         shape[0].second,
-        {shape[0].first, shape[0].first},
+        inputDims(shape[0].first),
         false
     ));
 
-    /* init rest of the network */
+    /* init rest of the network, every layer draws from its own random stream */
     for (size_t i = 1; i < shape.size(); i++) {
         m_layers.push_back(Layer<T>(
             shape[i].first,
             shape[i].second,
-            {shape[i].first, shape[i - 1].first},
-            true
+            m_layers.at(i - 1).getOutputDims(),
+            true,
+            seed,
+            i
         ));
     }
 }
 
+/*
+*   Independent single threaded network from a snapshot, e.g. to evaluate it on another thread while training continues.
+*   Built wherever it is needed, so the thread that took the snapshot only pays for the weight copy.
+*/
+template <typename T>
+NeuralNetwork<T>::NeuralNetwork(const ModelSnapshot<T> &model):
+    m_learningRate(model.learningRate)
+{
+    if (model.shape.size() < 2 || model.weights.size() != model.shape.size() - 1) {
+        std::cerr << "Snapshot does not describe a network" << std::endl;
+        throw std::invalid_argument("Snapshot does not describe a network");
+    }
+    if (model.shape[0].second != "none") {
+        std::cerr << "First layer must have no activation" << std::endl;
+        throw std::invalid_argument("First layer must have no activation");
+    }
+
+    m_layers.push_back(Layer<T>(
+        model.shape[0].first,
+        model.shape[0].second,
+        inputDims(model.shape[0].first),
+        false
+    ));
+
+    /* the weights are taken as they are, nothing is initialized just to be overwritten */
+    for (size_t i = 1; i < model.shape.size(); i++) {
+        m_layers.push_back(Layer<T>(
+            model.shape[i].first,
+            model.shape[i].second,
+            m_layers.at(i - 1).getOutputDims(),
+            model.weights[i - 1]
+        ));
+    }
+}
+
+/* a square input is treated as a single channel image, so convolutions can follow the input layer */
+template <typename T>
+Dims NeuralNetwork<T>::inputDims(const int neurons) {
+    int side = static_cast<int>(std::lround(std::sqrt(neurons)));
+    if (side * side == neurons) {
+        return {1, side, side};
+    }
+    return {neurons, 1, 1};
+}
+
 template <typename T>
 void NeuralNetwork<T>::loadModel(const std::string &path) {
     /* load model from filesystem */
@@ -85,37 +194,46 @@ void NeuralNetwork<T>::loadModel(const std::string &path) {
     m_layers.push_back(Layer<T>(
         inputNeurons,
         inputActivation,
-        {inputNeurons, inputNeurons},
+        inputDims(inputNeurons),
         false
     )); 
 
-    /* create the hidden and output layers */
+    /* create the hidden and output layers, units and descriptor as in the shape */
     for (int i = 1; i < numLayers + 1; i++) {
-        int neurons;
-        std::string activation;
-        modelFile >> neurons >> activation;
+        int units;
+        std::string descriptor;
+        modelFile >> units >> descriptor;
         m_layers.push_back(Layer<T>(
-            neurons,
-            activation,
-            {neurons, m_layers.at(i - 1).getNeurons()},
+            units,
+            descriptor,
+            m_layers.at(i - 1).getOutputDims(),
             true
         ));
     }
 
-    /* read and set the weights for the hidden and output layer */
+    /* read and set the weights for the hidden and output layer, the layers already have the right weight shape */
     for (int i = 1; i < m_layers.size(); i++) {
-        std::vector<std::vector<T>> weights;
-        for (int j = 0; j < m_layers.at(i).getNeurons(); j++) {
-            std::vector<T> row;
-            for (int k = 0; k < m_layers.at(i - 1).getNeurons(); k++) {
-                T weight;
+        std::vector<std::vector<T>> weights = m_layers.at(i).getWeights();
+        /* pooling layers have no weights */
+        if (weights.empty()) {
+            continue;
+        }
+        for (auto &row : weights) {
+            for (auto &weight : row) {
                 modelFile >> weight;
-                row.push_back(weight);
             }
-            weights.push_back(row);
         }
         m_layers.at(i).setWeights(weights);
     }
+
+    /* the new layers have to be distributed to the workers again */
+    if (m_pool) {
+        for (auto &layer : m_layers) {
+            layer.shard(m_pool.get());
+        }
+    }
+
+    recompile();
 }
 
 template <typename T>
@@ -126,41 +244,181 @@ void NeuralNetwork<T>::saveModel(const std::string &path) {
         throw std::runtime_error("Could not open file");
     }
 
+    writeModel(modelFile, snapshotWeights());
+
+    modelFile.close();
+}
+
+/* copies only what is needed to write or restore the model, the caller only stalls for the weight copy */
+template <typename T>
+ModelSnapshot<T> NeuralNetwork<T>::snapshotWeights() const {
+    ModelSnapshot<T> model;
+    model.learningRate = m_learningRate;
+    model.weights.reserve(m_layers.size() - 1);
+    for (size_t i = 0; i < m_layers.size(); i++) {
+        const Layer<T> &layer = m_layers.at(i);
+        model.shape.push_back({layer.getUnits(), layer.getDescriptor()});
+        if (i > 0) {
+            model.weights.push_back(layer.hasWeights() ? layer.getWeights() : std::vector<std::vector<T>>());
+        }
+    }
+    return model;
+}
+
+/*
+*   Serializes a snapshot in the model.txt format,
+*   shared by saveModel and the async checkpointer, which writes from a snapshot
+*/
+template <typename T>
+void NeuralNetwork<T>::writeModel(std::ostream &out, const ModelSnapshot<T> &model) {
     /* first line is the learningrate */
-    modelFile << m_learningRate << std::endl;
+    out << model.learningRate << std::endl;
 
     /* 
-    *   store number of layers and there activation function in the txt file 
+    *   store number of layers and there shape entry (units and descriptor) in the txt file 
     */
-    modelFile << m_layers.size() - 1 << std::endl;
-    for (auto &layer : m_layers) {
-        modelFile << layer.getNeurons() << " " << layer.getActivation() << std::endl;
+    out << model.shape.size() - 1 << std::endl;
+    for (auto &entry : model.shape) {
+        out << entry.first << " " << entry.second << std::endl;
     }
-    modelFile << std::endl;
+    out << std::endl;
 
-    /* store weights */
-    for (auto &layer : m_layers) {
-        /* skip the input layer */
-        if (layer.getActivation() == "none") {
+    /* store weights, pooling layers have none */
+    for (auto &weights : model.weights) {
+        if (weights.empty()) {
             continue;
         }
 
-        for (auto &row : layer.getWeights()) {
+        for (auto &row : weights) {
             for (auto &col : row) {
-                modelFile << col << " ";
+                out << col << " ";
             }
-            modelFile << std::endl;
+            out << std::endl;
         }
         /* empty line as break between layers */
-        modelFile << std::endl;
+        out << std::endl;
     }
-
-    modelFile.close();
 }
 
 template<typename T>
 NeuralNetwork<T>::~NeuralNetwork() {}
 
+template<typename T>
+NeuralNetwork<T>::NeuralNetwork(const NeuralNetwork &other):
+    m_layers(other.m_layers), m_learningRate(other.m_learningRate), m_plan(other.m_plan)
+{}
+
+template<typename T>
+NeuralNetwork<T> &NeuralNetwork<T>::operator=(const NeuralNetwork &other) {
+    if (this != &other) {
+        m_layers = other.m_layers;
+        m_learningRate = other.m_learningRate;
+        m_pool.reset();
+        m_plan = other.m_plan;
+    }
+    return *this;
+}
+
+/*
+*   Model parallel execution, the output rows of every layer are split into one shard per worker.
+*   Every worker owns its shard for the lifetime of the pool, so the rows stay in the workers cache and NUMA node.
+*   Meant for wide layers, for small layers the synchronization costs more than it saves.
+*/
+template<typename T>
+void NeuralNetwork<T>::enableRowSharding(const size_t numThreads) {
+    m_pool = std::make_shared<ThreadPool>(numThreads);
+    for (auto &layer : m_layers) {
+        layer.shard(m_pool.get());
+    }
+    recompile();
+}
+
+template<typename T>
+void NeuralNetwork<T>::disableRowSharding() {
+    for (auto &layer : m_layers) {
+        layer.shard(nullptr);
+    }
+    m_pool.reset();
+    recompile();
+}
+
+/*
+*   Validates shapes, activations and weights of every layer once and allocates all buffers for query and train.
+*   Afterwards query and train skip every size check and run the unchecked kernels, the caller has to pass
+*   inputs and targets of the right size. With debug set, the plan is validated but the checked path is kept.
+*/
+template<typename T>
+void NeuralNetwork<T>::compile(const bool debug) {
+    m_plan.reset();
+
+    const Layer<T> &inputLayer = m_layers.at(0);
+    if (inputLayer.getActivation() != "none") {
+        std::cerr << "First layer must have no activation" << std::endl;
+        throw std::invalid_argument("First layer must have no activation");
+    }
+    /* the input layer is only skipped, if it really is the identity */
+    std::vector<std::vector<T>> identity;
+    unit_matrix_initialization<T>(identity, {inputLayer.getNeurons(), inputLayer.getNeurons()});
+    if (inputLayer.getWeights() != identity) {
+        std::cerr << "Input layer must be the identity" << std::endl;
+        throw std::invalid_argument("Input layer must be the identity");
+    }
+
+    ExecutionPlan plan;
+    plan.debug = debug;
+    plan.outputs.resize(m_layers.size());
+    plan.errors.resize(m_layers.size());
+    plan.workspaces.resize(m_layers.size());
+    for (size_t i = 1; i < m_layers.size(); i++) {
+        m_layers.at(i).validate(m_layers.at(i - 1).getOutputDims());
+        plan.outputs.at(i).resize(m_layers.at(i).getNeurons());
+        plan.errors.at(i).resize(m_layers.at(i).getNeurons());
+        plan.workspaces.at(i) = m_layers.at(i).makeWorkspace();
+    }
+
+    m_plan = std::move(plan);
+}
+
+/* copies the weights of a snapshot with the same shape back, sharding and plan of this network are kept */
+template<typename T>
+void NeuralNetwork<T>::restoreWeights(const ModelSnapshot<T> &model) {
+    if (model.shape.size() != m_layers.size() || model.weights.size() != m_layers.size() - 1) {
+        std::cerr << "Snapshot does not match the network shape" << std::endl;
+        throw std::invalid_argument("Snapshot does not match the network shape");
+    }
+
+    for (size_t i = 0; i < m_layers.size(); i++) {
+        if (model.shape.at(i).first != m_layers.at(i).getUnits() || model.shape.at(i).second != m_layers.at(i).getDescriptor()) {
+            std::cerr << "Snapshot does not match the network shape" << std::endl;
+            throw std::invalid_argument("Snapshot does not match the network shape");
+        }
+    }
+
+    /* a compiled network runs unchecked kernels, so every matrix is checked before any is replaced */
+    for (size_t i = 1; i < m_layers.size(); i++) {
+        try {
+            m_layers.at(i).validateWeights(model.weights.at(i - 1));
+        } catch (const std::exception &e) {
+            std::cerr << "Snapshot does not match the network shape: " << e.what() << std::endl;
+            throw;
+        }
+    }
+
+    for (size_t i = 1; i < m_layers.size(); i++) {
+        if (m_layers.at(i).hasWeights()) {
+            m_layers.at(i).setWeights(model.weights.at(i - 1));
+        }
+    }
+}
+
+/* layers or sharding changed, the old plan does not fit anymore */
+template<typename T>
+void NeuralNetwork<T>::recompile() {
+    if (m_plan) {
+        compile(m_plan->debug);
+    }
+}
+
 template<typename T>
 void NeuralNetwork<T>::printweights() {
     for (auto &layer : m_layers) {
@@ -170,7 +428,11 @@ void NeuralNetwork<T>::printweights() {
 }
 
 template<typename T>
-std::vector<T> NeuralNetwork<T>::query(std::vector<T> input) {
+std::vector<T> NeuralNetwork<T>::query(const std::vector<T> &input) {
+    if (m_plan && !m_plan->debug) {
+        return queryCompiled(input);
+    }
+
     /* check if input fits */
     if (input.size() != m_layers.at(0).getNeurons()) {
         std::cerr << "Input size does not match input layer size" << std::endl;
@@ -181,15 +443,19 @@ std::vector<T> NeuralNetwork<T>::query(std::vector<T> input) {
 
     /* forward pass */
     for(auto &layer : m_layers) {
-        output = matrix_vector_multiplication(layer.getWeights(), output);
-        apply_function(output, layer.getActivationFunction());
+        output = layer.forward(output);
     }
 
     return output; 
 }
 
 template <typename T>   
-void NeuralNetwork<T>::train(std::vector<T> input, std::vector<T> target) {
+void NeuralNetwork<T>::train(const std::vector<T> &input, const std::vector<T> &target) {
+    if (m_plan && !m_plan->debug) {
+        trainCompiled(input, target);
+        return;
+    }
+
     /* check if input fits */
     if (input.size() != m_layers.at(0).getNeurons()) {
         std::cerr << "Input size does not match input layer size" << std::endl;
@@ -208,8 +474,7 @@ void NeuralNetwork<T>::train(std::vector<T> input, std::vector<T> target) {
 
     for(int i = 1; i < m_layers.size(); i++) {
         /* multiply the input with the weights, then apply the activation function */
-        output = matrix_vector_multiplication(m_layers.at(i).getWeights(), output);
-        apply_function(output, m_layers.at(i).getActivationFunction());
+        output = m_layers.at(i).forward(output);
         outputs.push_back(output);
     }
 
@@ -222,8 +487,7 @@ void NeuralNetwork<T>::train(std::vector<T> input, std::vector<T> target) {
 
     for (int i = m_layers.size() - 2; i > 0; i--) {
         /* hidden errors are split by weights and recombined into hidden nodes */
-        std::vector<T> nextError = matrix_vector_multiplication(transpose_matrix(m_layers.at(i + 1).getWeights()), error);
-        error = nextError;
+        error = m_layers.at(i + 1).backpropagateError(error, outputs.at(i - 1));
         errors.push_back(error);
     }
 
@@ -247,4 +511,39 @@ void NeuralNetwork<T>::train(std::vector<T> input, std::vector<T> target) {
     return;
 }
 
+template<typename T>
+std::vector<T> NeuralNetwork<T>::queryCompiled(const std::vector<T> &input) {
+    std::vector<std::vector<T>> &outputs = m_plan->outputs;
+    std::vector<Workspace<T>> &workspaces = m_plan->workspaces;
+    for (size_t i = 1; i < m_layers.size(); i++) {
+        m_layers[i].forwardUnchecked(i == 1 ? input : outputs[i - 1], outputs[i], workspaces[i]);
+    }
+    return outputs.back();
+}
+
+/* same as train, but on the preallocated buffers of the plan */
+template<typename T>
+void NeuralNetwork<T>::trainCompiled(const std::vector<T> &input, const std::vector<T> &target) {
+    std::vector<std::vector<T>> &outputs = m_plan->outputs;
+    std::vector<std::vector<T>> &errors = m_plan->errors;
+    std::vector<Workspace<T>> &workspaces = m_plan->workspaces;
+    size_t last = m_layers.size() - 1;
+
+    /* forward pass */
+    for (size_t i = 1; i <= last; i++) {
+        m_layers[i].forwardUnchecked(i == 1 ? input : outputs[i - 1], outputs[i], workspaces[i]);
+    }
+
+    /* backward pass, final error is target - actual */
+    subtract_vectors_unchecked(target, outputs[last], errors[last]);
+    for (size_t i = last; i > 1; i--) {
+        m_layers[i].backpropagateErrorUnchecked(errors[i], outputs[i - 1], errors[i - 1], workspaces[i]);
+    }
+
+    /* update weights, the errors are computed before any weight changes */
+    for (size_t i = 1; i <= last; i++) {
+        m_layers[i].updateWeightsUnchecked(errors[i], outputs[i], i == 1 ? input : outputs[i - 1], m_learningRate, workspaces[i]);
+    }
+}
+
 #endif
\ No newline at end of file
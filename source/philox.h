@@ -0,0 +1,61 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cstdint>
+
+/*
+*   Philox4x32-10 counter based random number generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+*   Every (key, counter) pair maps to 4 random 32 bit values without any state,
+*   so any element of a buffer can be generated independently of all others.
+*/
+namespace philox {
+    using Counter = std::array<uint32_t, 4>;
+    using Key = std::array<uint32_t, 2>;
+
+    constexpr uint32_t M0 = 0xD2511F53;
+    constexpr uint32_t M1 = 0xCD9E8D57;
+    constexpr uint32_t W0 = 0x9E3779B9;
+    constexpr uint32_t W1 = 0xBB67AE85;
+
+    inline Counter round(const Counter &ctr, const Key &key) {
+        uint64_t p0 = static_cast<uint64_t>(M0) * ctr[0];
+        uint64_t p1 = static_cast<uint64_t>(M1) * ctr[2];
+        return {
+            static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0],
+            static_cast<uint32_t>(p1),
+            static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1],
+            static_cast<uint32_t>(p0)
+        };
+    }
+
+    inline Counter philox4x32(Counter ctr, Key key) {
+        for (int i = 0; i < 10; i++) {
+            ctr = round(ctr, key);
+            key[0] += W0;
+            key[1] += W1;
+        }
+        return ctr;
+    }
+
+    inline Key makeKey(const uint64_t seed) {
+        return {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+    }
+
+    /* uniform value in [0, 1), the upper 24 bits fit exactly into a float mantissa */
+    template <typename T>
+    T toUniform(const uint32_t x) {
+        return static_cast<T>(x >> 8) * static_cast<T>(1.0 / 16777216.0);
+    }
+
+    /*
+    *   Block of the given stream (e.g. one stream per layer) that holds random value number index,
+    *   four consecutive indices share one block, the value itself is block[index % 4]
+    */
+    inline Counter block(const Key &key, const uint32_t stream, const uint64_t index) {
+        uint64_t b = index / 4;
+        return philox4x32({static_cast<uint32_t>(b), static_cast<uint32_t>(b >> 32), stream, 0}, key);
+    }
+}
+
+#endif
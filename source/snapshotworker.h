@@ -0,0 +1,138 @@
+#ifndef SNAPSHOTWORKER_H
+#define SNAPSHOTWORKER_H
+
+#include <string>
+#include <iostream>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+
+/*
+*   SnapshotWorker class
+*   Hands the latest snapshot to a handler on a background thread, so the submitting thread
+*   only pays for taking the snapshot. Pending is a single slot: if the worker is still busy,
+*   a newer snapshot replaces the waiting one (counted as dropped).
+*   Exceptions of the handler are reported and counted as failed, they never reach the submitter.
+*   The owner has to declare the worker as its last member, so it is joined before the state the handler uses is gone.
+*/
+template <typename Snapshot>
+class SnapshotWorker {
+    public:
+        SnapshotWorker(const std::string &task, const std::function<void(Snapshot &)> &handler);
+        ~SnapshotWorker();
+
+        SnapshotWorker(const SnapshotWorker &) = delete;
+        SnapshotWorker &operator=(const SnapshotWorker &) = delete;
+
+        void submit(Snapshot snapshot);
+        void wait();
+
+        size_t getDropped() const;
+        size_t getFailed() const;
+
+    private:
+        void run();
+
+        std::string m_task;
+        std::function<void(Snapshot &)> m_handler;
+
+        std::optional<Snapshot> m_pending;
+        bool m_busy = false;
+        bool m_stop = false;
+        size_t m_dropped = 0;
+        size_t m_failed = 0;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wakeWorker;
+        std::condition_variable m_idle;
+        std::thread m_worker;
+};
+
+template <typename Snapshot>
+SnapshotWorker<Snapshot>::SnapshotWorker(const std::string &task, const std::function<void(Snapshot &)> &handler):
+    m_task(task), m_handler(handler)
+{
+    m_worker = std::thread(&SnapshotWorker<Snapshot>::run, this);
+}
+
+template <typename Snapshot>
+SnapshotWorker<Snapshot>::~SnapshotWorker() {
+    /* handle the pending snapshot before shutting down */
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeWorker.notify_one();
+    m_worker.join();
+}
+
+template <typename Snapshot>
+void SnapshotWorker<Snapshot>::submit(Snapshot snapshot) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_pending) {
+            m_dropped++;
+        }
+        m_pending = std::move(snapshot);
+    }
+    m_wakeWorker.notify_one();
+}
+
+/* blocks until every submitted snapshot is handled */
+template <typename Snapshot>
+void SnapshotWorker<Snapshot>::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return !m_pending && !m_busy; });
+}
+
+template <typename Snapshot>
+size_t SnapshotWorker<Snapshot>::getDropped() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+template <typename Snapshot>
+size_t SnapshotWorker<Snapshot>::getFailed() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_failed;
+}
+
+template <typename Snapshot>
+void SnapshotWorker<Snapshot>::run() {
+    while (true) {
+        std::optional<Snapshot> snapshot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeWorker.wait(lock, [this] { return m_pending || m_stop; });
+            if (!m_pending) {
+                return;
+            }
+            snapshot = std::move(m_pending);
+            m_pending.reset();
+            m_busy = true;
+        }
+
+        /* a failed snapshot must not take down the training run */
+        bool failed = false;
+        try {
+            m_handler(*snapshot);
+        } catch (const std::exception &e) {
+            std::cerr << "Exception in " << m_task << ": " << e.what() << std::endl;
+            failed = true;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (failed) {
+                m_failed++;
+            }
+            m_busy = false;
+        }
+        m_idle.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+*   ThreadPool class
+*   Fixed set of workers, worker i always executes shard i of a task.
+*   Data a worker allocates first stays on its NUMA node, because on linux
+*   the workers are pinned to one core each (round robin over the cores the process may use).
+*   run() hands one task to all workers and returns once every shard is done,
+*   concurrent callers are served one after another. A task must not call run() itself.
+*/
+class ThreadPool {
+    public:
+        ThreadPool(const size_t numThreads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const { return m_workers.size(); }
+        void run(const std::function<void(size_t)> &task);
+
+    private:
+        void work(const size_t shard, const int cpu);
+
+        std::vector<std::thread> m_workers;
+        const std::function<void(size_t)> *m_task = nullptr;
+        size_t m_generation = 0;
+        size_t m_remaining = 0;
+        bool m_stop = false;
+        std::exception_ptr m_exception;
+
+        /* held for a whole run, so only one task is in flight */
+        std::mutex m_runMutex;
+        std::mutex m_mutex;
+        std::condition_variable m_start;
+        std::condition_variable m_done;
+};
+
+inline ThreadPool::ThreadPool(const size_t numThreads) {
+    if (numThreads == 0) {
+        std::cerr << "Atleast one thread is needed" << std::endl;
+        throw std::invalid_argument("Atleast one thread is needed");
+    }
+
+    /* cores this process may run on, -1 leaves the worker unpinned */
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    } else {
+        std::cerr << "Could not read the cpu affinity, workers are not pinned" << std::endl;
+    }
+#endif
+
+    for (size_t i = 0; i < numThreads; i++) {
+        m_workers.emplace_back(&ThreadPool::work, this, i, cpus.empty() ? -1 : cpus[i % cpus.size()]);
+    }
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start.notify_all();
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+inline void ThreadPool::run(const std::function<void(size_t)> &task) {
+    std::unique_lock<std::mutex> runLock(m_runMutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_remaining = m_workers.size();
+    m_exception = nullptr;
+    m_generation++;
+    m_start.notify_all();
+
+    m_done.wait(lock, [this] { return m_remaining == 0; });
+    m_task = nullptr;
+
+    if (m_exception) {
+        std::rethrow_exception(m_exception);
+    }
+}
+
+inline void ThreadPool::work(const size_t shard, const int cpu) {
+#ifdef __linux__
+    /* pin worker to a core, so first touch allocations stay local */
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+        if (result != 0) {
+            std::cerr << "Could not pin worker " << shard << " to cpu " << cpu << ": " << std::strerror(result) << std::endl;
+        }
+    }
+#else
+    (void)cpu;
+#endif
+
+    size_t seen = 0;
+    while (true) {
+        const std::function<void(size_t)> *task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&] { return m_generation != seen || m_stop; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_generation;
+            task = m_task;
+        }
+
+        std::exception_ptr exception;
+        try {
+            (*task)(shard);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (exception && !m_exception) {
+            m_exception = exception;
+        }
+        if (--m_remaining == 0) {
+            m_done.notify_one();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+
+#include "neuralnetwork.h"
+#include "snapshotworker.h"
+
+/* one validation run: when (training step and wall clock seconds since start) and how good */
+struct ValidationEntry {
+    size_t step;
+    double seconds;
+    float accuracy;
+};
+
+/*
+*   ValidationMonitor class
+*   Evaluates snapshots of the network weights on a held out split on a background thread,
+*   so training only stalls for the weight copy. The worker builds and compiles its evaluation
+*   network from the first snapshot and only swaps the weights in for every later one.
+*   Keeps the best snapshot and signals early stopping once the accuracy did not improve
+*   by more than minDelta for patience evaluations in a row.
+*   If the worker is still busy, a newer snapshot replaces the waiting one (counted as dropped).
+*/
+template <typename T>
+class ValidationMonitor {
+    public:
+        ValidationMonitor(const std::vector<std::vector<T>> &inputs, const std::vector<int> &labels, const size_t patience, const float minDelta);
+
+        void submit(const NeuralNetwork<T> &nn, const size_t step);
+        void wait();
+
+        bool shouldStop() const { return m_stopTraining; }
+        float getBestAccuracy() const;
+        size_t getBestStep() const;
+        size_t getDropped() const;
+        bool hasBest() const;
+        void restoreBest(NeuralNetwork<T> &nn) const;
+        std::vector<ValidationEntry> getLog() const;
+
+    private:
+        struct Snapshot {
+            ModelSnapshot<T> model;
+            size_t step;
+        };
+
+        void evaluate(Snapshot &snapshot);
+        float accuracy(NeuralNetwork<T> &nn) const;
+
+        std::vector<std::vector<T>> m_inputs;
+        std::vector<int> m_labels;
+        size_t m_patience;
+        float m_minDelta;
+        std::chrono::steady_clock::time_point m_start;
+
+        /* only used by the worker */
+        std::optional<NeuralNetwork<T>> m_network;
+
+        std::optional<Snapshot> m_best;
+        float m_bestAccuracy = -1.0;
+        size_t m_evaluationsWithoutImprovement = 0;
+        std::vector<ValidationEntry> m_log;
+        std::atomic<bool> m_stopTraining{false};
+        mutable std::mutex m_mutex;
+
+        /* last member, joined before the state evaluate uses is destroyed */
+        SnapshotWorker<Snapshot> m_worker;
+};
+
+template <typename T>
+ValidationMonitor<T>::ValidationMonitor(const std::vector<std::vector<T>> &inputs, const std::vector<int> &labels, const size_t patience, const float minDelta):
+    m_inputs(inputs), m_labels(labels), m_patience(patience), m_minDelta(minDelta), m_start(std::chrono::steady_clock::now()),
+    m_worker("validation", [this](Snapshot &snapshot) { evaluate(snapshot); })
+{
+    if (inputs.empty() || inputs.size() != labels.size()) {
+        std::cerr << "Validation inputs and labels do not match" << std::endl;
+        throw std::invalid_argument("Validation inputs and labels do not match");
+    }
+    if (patience == 0) {
+        std::cerr << "Patience must be atleast one evaluation" << std::endl;
+        throw std::invalid_argument("Patience must be atleast one evaluation");
+    }
+}
+
+template <typename T>
+void ValidationMonitor<T>::submit(const NeuralNetwork<T> &nn, const size_t step) {
+    m_worker.submit(Snapshot{nn.snapshotWeights(), step});
+}
+
+/* blocks until every submitted snapshot is evaluated */
+template <typename T>
+void ValidationMonitor<T>::wait() {
+    m_worker.wait();
+}
+
+template <typename T>
+float ValidationMonitor<T>::getBestAccuracy() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_bestAccuracy;
+}
+
+template <typename T>
+size_t ValidationMonitor<T>::getBestStep() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_best ? m_best->step : 0;
+}
+
+template <typename T>
+size_t ValidationMonitor<T>::getDropped() const {
+    return m_worker.getDropped();
+}
+
+template <typename T>
+bool ValidationMonitor<T>::hasBest() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_best.has_value();
+}
+
+/* copies the weights of the best evaluated snapshot into nn */
+template <typename T>
+void ValidationMonitor<T>::restoreBest(NeuralNetwork<T> &nn) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_best) {
+        throw std::runtime_error("No snapshot has been evaluated yet");
+    }
+    nn.restoreWeights(m_best->model);
+}
+
+template <typename T>
+std::vector<ValidationEntry> ValidationMonitor<T>::getLog() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_log;
+}
+
+/*
+*   Runs on the worker. The evaluation network and its plan (including the identity check of compile)
+*   are built once, afterwards restoreWeights checks every snapshot against it
+*/
+template <typename T>
+void ValidationMonitor<T>::evaluate(Snapshot &snapshot) {
+    if (!m_network) {
+        /* the compiled network reads the inputs unchecked */
+        size_t inputSize = snapshot.model.shape.front().first;
+        for (const auto &input : m_inputs) {
+            if (input.size() != inputSize) {
+                throw std::invalid_argument("Validation input size does not match the network input");
+            }
+        }
+
+        NeuralNetwork<T> network(snapshot.model);
+        network.compile();
+        m_network = std::move(network);
+    } else {
+        m_network->restoreWeights(snapshot.model);
+    }
+
+    float result = accuracy(*m_network);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_log.push_back({snapshot.step, seconds, result});
+
+    if (result > m_bestAccuracy + m_minDelta) {
+        m_bestAccuracy = result;
+        m_best = std::move(snapshot);
+        m_evaluationsWithoutImprovement = 0;
+    } else if (++m_evaluationsWithoutImprovement >= m_patience) {
+        m_stopTraining = true;
+    }
+}
+
+template <typename T>
+float ValidationMonitor<T>::accuracy(NeuralNetwork<T> &nn) const {
+    size_t correct = 0;
+    for (size_t i = 0; i < m_inputs.size(); i++) {
+        std::vector<T> output = nn.query(m_inputs[i]);
+        int prediction = std::distance(output.begin(), std::max_element(output.begin(), output.end()));
+        if (prediction == m_labels[i]) {
+            correct++;
+        }
+    }
+    return static_cast<float>(correct) / m_inputs.size();
+}
+
+#endif
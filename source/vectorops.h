@@ -4,6 +4,7 @@
 /*
 *   Vector operations bases on std::vector<T>
 *   Matrix operations based on std::vector<std::vector<T>>
+*   Elementwise operations are evaluated through the expression templates in expressions.h
 */
 
 #include <iostream>
@@ -11,32 +12,99 @@
 #include <chrono>
 #include <random>
 #include <functional>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cstdint>
 
+#include "philox.h"
+#include "expressions.h"
+
+/*
+*   Uniform distribution in range [low, high)
+*   Element (i, j) is drawn from the philox counter i * cols + j of the given stream,
+*   so the result only depends on seed and stream, not on the number of threads.
+*   Every thread allocates and fills its own rows.
+*/
 template <typename T>
 void uniform_random_initialization (
     std::vector<std::vector<T>> &A,
     const std::pair<size_t, size_t> &shape,
-    const T &low, const T &high
+    const T &low, const T &high,
+    const uint64_t seed, const uint32_t stream
 ){
     A.clear();  
-    /* Uniform distribution in range [low, high] */
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_real_distribution<T> distribution(low, high);
-    for (size_t i = 0; i < shape.first; i++) {  
-        std::vector<T> row;  
-        row.resize(shape.second);
-        for (auto &r : row) {             
-            r = distribution(generator);  
-            if (r > 1.0) {
-                std::cerr << "Random number greater than 1.0: " << r << std::endl;
+    A.resize(shape.first);
+
+    const philox::Key key = philox::makeKey(seed);
+    auto fillRows = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            A[i].resize(shape.second);
+            philox::Counter block{};
+            for (size_t j = 0; j < shape.second; j++) {
+                uint64_t index = i * shape.second + j;
+                /* one philox call yields the values for four consecutive indices */
+                if (j == 0 || index % 4 == 0) {
+                    block = philox::block(key, stream, index);
+                }
+                A[i][j] = low + (high - low) * philox::toUniform<T>(block[index % 4]);
             }
         }
-        A.push_back(row);  
+    };
+
+    /* small matrices are not worth the thread startup */
+    size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    if (shape.first * shape.second < (1 << 16) || shape.first < numThreads) {
+        numThreads = 1;
+    }
+
+    std::vector<std::thread> threads;
+    size_t rowsPerThread = (shape.first + numThreads - 1) / numThreads;
+    for (size_t t = 1; t < numThreads; t++) {
+        size_t begin = std::min(shape.first, t * rowsPerThread);
+        size_t end = std::min(shape.first, begin + rowsPerThread);
+        threads.emplace_back(fillRows, begin, end);
+    }
+    fillRows(0, std::min(shape.first, rowsPerThread));
+    for (auto &thread : threads) {
+        thread.join();
     }
     return;
 }
 
+/* Xavier/Glorot uniform, keeps the variance stable for sigmoid and tanh layers */
+template <typename T>
+void xavier_uniform_initialization (
+    std::vector<std::vector<T>> &A,
+    const std::pair<size_t, size_t> &shape,
+    const size_t fanIn, const size_t fanOut,
+    const uint64_t seed, const uint32_t stream
+){
+    T limit = std::sqrt(T(6) / static_cast<T>(fanIn + fanOut));
+    uniform_random_initialization<T>(A, shape, -limit, limit, seed, stream);
+}
+
+/* dense weight matrix, fan in is the number of columns and fan out the number of rows */
+template <typename T>
+void xavier_uniform_initialization (
+    std::vector<std::vector<T>> &A,
+    const std::pair<size_t, size_t> &shape,
+    const uint64_t seed, const uint32_t stream
+){
+    xavier_uniform_initialization<T>(A, shape, shape.second, shape.first, seed, stream);
+}
+
+/* He uniform, accounts for relu zeroing half of the inputs */
+template <typename T>
+void he_uniform_initialization (
+    std::vector<std::vector<T>> &A,
+    const std::pair<size_t, size_t> &shape,
+    const uint64_t seed, const uint32_t stream
+){
+    T limit = std::sqrt(T(6) / static_cast<T>(shape.second));
+    uniform_random_initialization<T>(A, shape, -limit, limit, seed, stream);
+}
+
 template <typename T>
 void unit_matrix_initialization (
     std::vector<std::vector<T>> &A,
@@ -53,45 +121,189 @@ void unit_matrix_initialization (
 }
 
 template <typename T>
-std::vector<T> matrix_vector_multiplication (
+std::vector<std::vector<T>> transpose_matrix (
+    const std::vector<std::vector<T>> &A
+){
+    if (A.empty()) {
+        throw std::invalid_argument("Cannot transpose an empty matrix");
+    }
+
+    std::vector<std::vector<T>> B;
+    expressions::assign(B, expressions::transpose(expressions::view(A)));
+    return B;
+}
+
+/*
+*   Unchecked multiplication kernels for the hot path, C has to be allocated with the shape of the result,
+*   its contents are overwritten. The transposed variants read A or B transposed in place, without a copy.
+*/
+
+/* C = A * B, i-k-j order so the inner loop runs over contiguous rows of B and C */
+template <typename T>
+void matrix_matrix_multiplication_unchecked (
+    const std::vector<std::vector<T>> &A,
+    const std::vector<std::vector<T>> &B,
+    std::vector<std::vector<T>> &C
+){
+    for (size_t i = 0; i < A.size(); i++) {
+        T *c = C[i].data();
+        std::fill(C[i].begin(), C[i].end(), T(0));
+        for (size_t k = 0; k < B.size(); k++) {
+            T a = A[i][k];
+            const T *b = B[k].data();
+            for (size_t j = 0; j < C[i].size(); j++) {
+                c[j] += a * b[j];
+            }
+        }
+    }
+}
+
+/* C = A^T * B, k-i-j order so every row of A and B is read once */
+template <typename T>
+void transposed_matrix_multiplication_unchecked (
     const std::vector<std::vector<T>> &A,
-    const std::vector<T> &B
+    const std::vector<std::vector<T>> &B,
+    std::vector<std::vector<T>> &C
 ){
-    try {
-        /* check dimensions */
-        if (A.empty() || A.at(0).size() != B.size()) {
-            throw std::invalid_argument("Matrix and vector dimensions do not match");
+    for (auto &row : C) {
+        std::fill(row.begin(), row.end(), T(0));
+    }
+    for (size_t k = 0; k < A.size(); k++) {
+        const T *b = B[k].data();
+        for (size_t i = 0; i < C.size(); i++) {
+            T a = A[k][i];
+            T *c = C[i].data();
+            for (size_t j = 0; j < C[i].size(); j++) {
+                c[j] += a * b[j];
+            }
         }
+    }
+}
 
-        std::vector<T> C;
-        for (size_t i = 0; i < A.size(); i++) {
+/* C = A * B^T, every element is a dot product of two contiguous rows */
+template <typename T>
+void matrix_transposed_multiplication_unchecked (
+    const std::vector<std::vector<T>> &A,
+    const std::vector<std::vector<T>> &B,
+    std::vector<std::vector<T>> &C
+){
+    for (size_t i = 0; i < C.size(); i++) {
+        const T *a = A[i].data();
+        for (size_t j = 0; j < C[i].size(); j++) {
+            const T *b = B[j].data();
             T sum = 0;
-            for (size_t j = 0; j < B.size(); j++) {
-                sum += A.at(i).at(j) * B.at(j);
+            for (size_t k = 0; k < A[i].size(); k++) {
+                sum += a[k] * b[k];
             }
-            C.push_back(sum);
+            C[i][j] = sum;
         }
+    }
+}
 
-        return C;
-    } catch (const std::exception &e) {
-        std::cerr << "Exception in matrix vector multiplication: " <<  e.what() << std::endl;
-        throw;
+/* C = A * B with checks, allocates C */
+template <typename T>
+std::vector<std::vector<T>> matrix_matrix_multiplication (
+    const std::vector<std::vector<T>> &A,
+    const std::vector<std::vector<T>> &B
+){
+    if (A.empty() || B.empty() || A.at(0).size() != B.size()) {
+        throw std::invalid_argument("Matrix dimensions for multiplication do not match");
     }
+
+    std::vector<std::vector<T>> C(A.size(), std::vector<T>(B.at(0).size()));
+    matrix_matrix_multiplication_unchecked(A, B, C);
+    return C;
 }
 
+/*
+*   Unrolls every kxk patch of a (channels, height, width) image into one column,
+*   so a convolution becomes a single matrix multiplication with the filter matrix
+*   row = c * k * k + ky * k + kx, column = y * outWidth + x (stride 1, no padding)
+*   No checks, cols has to be allocated with (channels * k * k) rows of outHeight * outWidth
+*/
 template <typename T>
-std::vector<std::vector<T>> transpose_matrix (
-    const std::vector<std::vector<T>> &A
+void im2col_unchecked (
+    const std::vector<T> &image,
+    const int channels, const int height, const int width,
+    const int kernel,
+    std::vector<std::vector<T>> &cols
 ){
-    std::vector<std::vector<T>> B;
-    for (size_t i = 0; i < A.at(0).size(); i++) {
-        std::vector<T> row;
-        for (size_t j = 0; j < A.size(); j++) {
-            row.push_back(A.at(j).at(i));
+    int outHeight = height - kernel + 1;
+    int outWidth = width - kernel + 1;
+    for (int c = 0; c < channels; c++) {
+        for (int ky = 0; ky < kernel; ky++) {
+            for (int kx = 0; kx < kernel; kx++) {
+                std::vector<T> &row = cols[(c * kernel + ky) * kernel + kx];
+                for (int y = 0; y < outHeight; y++) {
+                    const T *src = &image[(c * height + y + ky) * width + kx];
+                    std::copy(src, src + outWidth, &row[y * outWidth]);
+                }
+            }
         }
-        B.push_back(row);
     }
-    return B;
+}
+
+/* im2col with checks, allocates the columns */
+template <typename T>
+std::vector<std::vector<T>> im2col (
+    const std::vector<T> &image,
+    const int channels, const int height, const int width,
+    const int kernel
+){
+    if (image.size() != static_cast<size_t>(channels * height * width) || kernel > height || kernel > width) {
+        throw std::invalid_argument("Image dimensions do not match for im2col");
+    }
+
+    std::vector<std::vector<T>> cols(channels * kernel * kernel, std::vector<T>((height - kernel + 1) * (width - kernel + 1)));
+    im2col_unchecked(image, channels, height, width, kernel, cols);
+    return cols;
+}
+
+/*
+*   Inverse of im2col, overlapping patches are summed up
+*   No checks, image has to be allocated with channels * height * width, it is overwritten
+*/
+template <typename T>
+void col2im_unchecked (
+    const std::vector<std::vector<T>> &cols,
+    const int channels, const int height, const int width,
+    const int kernel,
+    std::vector<T> &image
+){
+    int outHeight = height - kernel + 1;
+    int outWidth = width - kernel + 1;
+    std::fill(image.begin(), image.end(), T(0));
+    for (int c = 0; c < channels; c++) {
+        for (int ky = 0; ky < kernel; ky++) {
+            for (int kx = 0; kx < kernel; kx++) {
+                const std::vector<T> &row = cols[(c * kernel + ky) * kernel + kx];
+                for (int y = 0; y < outHeight; y++) {
+                    T *dst = &image[(c * height + y + ky) * width + kx];
+                    for (int x = 0; x < outWidth; x++) {
+                        dst[x] += row[y * outWidth + x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* col2im with checks, allocates the image */
+template <typename T>
+std::vector<T> col2im (
+    const std::vector<std::vector<T>> &cols,
+    const int channels, const int height, const int width,
+    const int kernel
+){
+    int outHeight = height - kernel + 1;
+    int outWidth = width - kernel + 1;
+    if (cols.size() != static_cast<size_t>(channels * kernel * kernel) || cols.at(0).size() != static_cast<size_t>(outHeight * outWidth)) {
+        throw std::invalid_argument("Column dimensions do not match for col2im");
+    }
+
+    std::vector<T> image(channels * height * width);
+    col2im_unchecked(cols, channels, height, width, kernel, image);
+    return image;
 }
 
 template <typename T>
@@ -100,13 +312,7 @@ std::vector<std::vector<T>> scalar_matrix_multiplication (
     const std::vector<std::vector<T>> &A
 ){
     std::vector<std::vector<T>> B;
-    for (size_t i = 0; i < A.size(); i++) {
-        std::vector<T> row;
-        for (size_t j = 0; j < A.at(0).size(); j++) {
-            row.push_back(A.at(i).at(j) * scalar);
-        }
-        B.push_back(row);
-    }
+    expressions::assign(B, expressions::view(A) * scalar);
     return B;
 }
 
@@ -115,44 +321,30 @@ std::vector<std::vector<T>> matrix_matrix_addition (
     const std::vector<std::vector<T>> &A,
     const std::vector<std::vector<T>> &B
 ){
-    std::vector<std::vector<T>> C;
-
     if (A.size() != B.size() || A.at(0).size() != B.at(0).size()) {
         throw std::invalid_argument("Matrix dimensions for addition do not match");
     }
 
-    try {
-        for (size_t i = 0; i < A.size(); i++) {
-            std::vector<T> row;
-            for (size_t j = 0; j < A.at(0).size(); j++) {
-                row.push_back(A.at(i).at(j) + B.at(i).at(j));
-            }
-            C.push_back(row);
-        }
-        return C;
-    } catch (const std::exception &e) {
-        std::cerr << "Exception in adding matrices: " <<  e.what() << std::endl;
-        throw;
-    }
+    std::vector<std::vector<T>> C;
+    expressions::assign(C, expressions::view(A) + expressions::view(B));
+    return C;
 }
 
 template <typename T>
-std::vector<T> subtract_vectors(std::vector<T> A, std::vector<T> B) {
-    std::vector<T> C;
-
+std::vector<T> subtract_vectors(const std::vector<T> &A, const std::vector<T> &B) {
     if (A.size() != B.size()) {
         throw std::invalid_argument("Vector dimensions do not match");
     }
 
-    try {
-        for (size_t i = 0; i < A.size(); i++) {
-            C.push_back(A.at(i) - B.at(i));
-        }
-        return C;
-    } catch (const std::exception &e) {
-        std::cerr << "Exception in subtracting vectors: " <<  e.what() << std::endl;
-        throw;
-    }
+    std::vector<T> C;
+    expressions::assign(C, expressions::view(A) - expressions::view(B));
+    return C;
+}
+
+/* C = A - B, no checks, C has to be allocated with the size of A and B */
+template <typename T>
+void subtract_vectors_unchecked(const std::vector<T> &A, const std::vector<T> &B, std::vector<T> &C) {
+    expressions::assign(C, expressions::view(A) - expressions::view(B));
 }
 
 template <typename T>